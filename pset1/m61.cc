@@ -8,6 +8,10 @@
 
 
 #include <unordered_map>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 #include <iostream>
 using namespace std;
@@ -24,14 +28,115 @@ bool first_malloc=1;
 unordered_map <void*,int> main_meta;                            //main metadata - stores data for free - stores the size or -1 if the pointer was freed
 unordered_map <void*, pair<const char*,long>> meta_leak;       //second metadata - stores data for leak reports and error reports - stores the file and line for each pointer
 
-unordered_map <long, pair<pair<unsigned long long,unsigned long long>,const char*>> meta_hh;
-//third metadata - stores data for heavy hitter report
-//for each line, it stores the size of the bytes allocated and the number of allocations for that line
+struct m61_site {
+    unsigned long long nactive;         // # active allocations from this site
+    unsigned long long active_size;     // # bytes in active allocations from this site
+    unsigned long long ntotal;          // # total allocations from this site
+    unsigned long long total_size;      // # bytes in total allocations from this site
+    m61_limit limit;                    // limits on active bytes from this site
+    bool over_soft;                     // whether we warned about the soft limit
+};
+struct m61_site_hash {
+    size_t operator()(const pair<const char*,long>& key) const {
+        return hash<const void*>()(key.first)*31+hash<long>()(key.second);
+    }
+};
+unordered_map <pair<const char*,long>, m61_site, m61_site_hash> meta_site;
+//third metadata - stores data for heavy hitter and heap profile reports
+//for each file:line site, it stores the active and total bytes and allocation counts
 //the number of allocations is used to detect the frequent hitters
+//it is hashed so that each allocation costs one probe; reports sort it (see sorted_sites)
+
+struct m61_tag {
+    m61_statistics stats;               // statistics for allocations under this tag
+    m61_limit limit;                    // limits on active bytes under this tag
+    bool over_soft;                     // whether we warned about the soft limit
+};
+map <string, m61_tag> meta_tag_stats;                          //per-tag statistics - one entry per tag name ever used by m61_scope_tag
+unordered_map <void*, m61_tag*> meta_tag;                      //tag of each active pointer allocated while a tag was set (others are absent)
+thread_local m61_tag* current_tag=nullptr;                     //the innermost active m61_scope_tag on this thread
 
 unordered_map <void*, pair <void*,void*>> link_map;            //fourth metadata - used to detect double frees
 void* last_ptr;                                                //used with the fourth metadata - it stores the last pointer that was added to the list
 
+m61_limit global_limit={0,0};           // limits on all active bytes
+bool global_over_soft=0;                // whether we warned about the global soft limit
+m61_fail_injection injection={0,0,0,0}; // injected failure configuration
+unsigned long long ninjection_calls=0;  // allocation attempts seen since injection was configured
+unsigned long long injection_rng=0;     // xorshift state for probabilistic injection
+bool checks_enabled=0;                  // whether any limit or injection was ever configured
+
+
+//record_fail(sz)
+//    Count a failed allocation attempt of `sz` bytes, globally and for the current tag.
+
+static void record_fail(size_t sz) {
+    nfail++;
+    fail_size+=sz;
+    if (m61_tag* tag=current_tag){
+        tag->stats.nfail++;
+        tag->stats.fail_size+=sz;
+    }
+}
+
+//over_hard(limit, active, sz)
+//    Return true if adding `sz` bytes to `active` would break `limit.hard`.
+
+static bool over_hard(const m61_limit& limit, unsigned long long active, size_t sz) {
+    return limit.hard && (active+sz>limit.hard || active+sz<active);
+}
+
+//warn_soft(limit, over_soft, active, sz, file, line, what)
+//    Warn once when adding `sz` bytes to `active` first crosses `limit.soft`.
+
+static void warn_soft(const m61_limit& limit, bool& over_soft,
+                      unsigned long long active, size_t sz,
+                      const char* file, long line, const char* what) {
+    if (limit.soft && active+sz>limit.soft && !over_soft) {
+        over_soft=1;
+        cerr<<"MEMORY WARNING: "<<file<<":"<<line<<": "<<what<<" active size "<<active+sz<<" exceeds soft limit "<<limit.soft<<endl;
+    }
+}
+
+//should_fail(sz, site, file, line)
+//    Return true if an allocation of `sz` bytes at `site` must fail because
+//    of a hard limit or an injected failure. Every check is O(1).
+
+static bool should_fail(size_t sz, m61_site& site, const char* file, long line) {
+    //Injected failures:
+    if (injection.every || injection.probability>0){
+        ninjection_calls++;
+        if (ninjection_calls>injection.after){
+            unsigned long long n=ninjection_calls-injection.after;
+            if (injection.every && n%injection.every==0){
+                return 1;
+            }
+            if (injection.probability>0){
+                injection_rng^=injection_rng<<13;
+                injection_rng^=injection_rng>>7;
+                injection_rng^=injection_rng<<17;
+                if ((double)(injection_rng>>11)/(double)(1ULL<<53)<injection.probability){
+                    return 1;
+                }
+            }
+        }
+    }
+    //Hard limits:
+    m61_tag* tag=current_tag;
+    if (over_hard(global_limit,active_size,sz)
+        || (tag && over_hard(tag->limit,tag->stats.active_size,sz))
+        || over_hard(site.limit,site.active_size,sz)){
+        return 1;
+    }
+    //The allocation will go ahead, so warn about soft limits:
+    warn_soft(global_limit,global_over_soft,active_size,sz,file,line,"heap");
+    if (tag){
+        warn_soft(tag->limit,tag->over_soft,tag->stats.active_size,sz,file,line,"tag");
+    }
+    warn_soft(site.limit,site.over_soft,site.active_size,sz,file,line,"site");
+    return 0;
+}
+
 /// m61_malloc(sz, file, line)
 ///    Return a pointer to `sz` bytes of newly-allocated dynamic memory.
 ///    The memory is not initialized. If `sz == 0`, then m61_malloc must
@@ -44,10 +149,14 @@ void* m61_malloc(size_t sz, const char* file, long line) {
     // Your code here.
 	if (sz+16<sz) {
         //We will need 16 bytes to detect boundary write errors so we're checking that adding 16 to the size won't cause overflow
-		nfail++;
-        fail_size+=sz;
+        record_fail(sz);
 		return nullptr;
 	}
+    m61_site& site=meta_site[{file,line}];
+    if (checks_enabled && should_fail(sz,site,file,line)){
+        record_fail(sz);
+        return nullptr;
+    }
     void* p=base_malloc(sz+16);
     if (p!=nullptr){
         nactive++;
@@ -58,13 +167,23 @@ void* m61_malloc(size_t sz, const char* file, long line) {
         meta_leak[p].first=file;
         meta_leak[p].second=line;
 
-        meta_hh[line].first.first+=sz;
-        meta_hh[line].first.second+=1;
-        meta_hh[line].second=file;
+        site.nactive++;
+        site.active_size+=sz;
+        site.ntotal++;
+        site.total_size+=sz;
 
         ntotal++;
         total_size+=sz;
 
+        //One thread-local load decides whether this allocation is tagged:
+        if (m61_tag* tag=current_tag){
+            tag->stats.nactive++;
+            tag->stats.active_size+=sz;
+            tag->stats.ntotal++;
+            tag->stats.total_size+=sz;
+            meta_tag[p]=tag;
+        }
+
         unsigned long long int h=-1; //magic number to check boundary write errors
         memcpy(p+sz,&h,8);
         memcpy(p+sz+8,&h,8);
@@ -90,8 +209,7 @@ void* m61_malloc(size_t sz, const char* file, long line) {
         return p;
     }
     else {
-        nfail++;
-        fail_size+=sz;
+        record_fail(sz);
         return p;
     }
 }
@@ -173,6 +291,22 @@ void m61_free(void* ptr, const char* file, long line) {
 
     nactive--;
     active_size-=main_meta[ptr];
+    m61_site& site=meta_site[meta_leak[ptr]];
+    site.nactive--;
+    site.active_size-=main_meta[ptr];
+    if (!meta_tag.empty()){
+        auto tag_it=meta_tag.find(ptr);
+        if (tag_it!=meta_tag.end()){
+            m61_tag* tag=tag_it->second;
+            tag->stats.nactive--;
+            tag->stats.active_size-=main_meta[ptr];
+            //Warn again if the tag climbs back over its soft limit:
+            if (tag->stats.active_size<=tag->limit.soft) tag->over_soft=0;
+            meta_tag.erase(tag_it);
+        }
+    }
+    if (active_size<=global_limit.soft) global_over_soft=0;
+    if (site.active_size<=site.limit.soft) site.over_soft=0;
     main_meta[ptr]=-1; //Storing -1 to say that it has been freed (for leak checks)
     base_free(ptr);
 }
@@ -196,8 +330,7 @@ void* m61_calloc(size_t nmemb, size_t sz, const char* file, long line) {
 	else{
 	    //This is a very big size and we can't allocate it:
 		ptr=nullptr;
-		nfail++;
-        fail_size+=sz*nmemb;
+        record_fail(sz*nmemb);
 	}
 	if (ptr) {
         	memset(ptr, 0, nmemb * sz);
@@ -228,6 +361,72 @@ void m61_get_statistics(m61_statistics* stats) {
 }
 
 
+/// m61_get_statistics(stats, tag)
+///    Store the memory statistics for allocations made under `tag` in `*stats`.
+
+void m61_get_statistics(m61_statistics* stats, const char* tag) {
+    memset(stats, 0, sizeof(m61_statistics));
+    auto it=meta_tag_stats.find(tag);
+    if (it!=meta_tag_stats.end()){
+        *stats=it->second.stats;
+    }
+    //The heap bounds are shared by every tag:
+    stats->heap_min=	heap_min;
+    stats->heap_max=	heap_max;
+}
+
+
+/// m61_scope_tag(tag)
+///    Attribute this thread's allocations to `tag` until destroyed.
+
+m61_scope_tag::m61_scope_tag(const char* tag)
+    : prev_(current_tag) {
+    current_tag=&meta_tag_stats[tag];
+}
+
+m61_scope_tag::~m61_scope_tag() {
+    current_tag=prev_;
+}
+
+
+/// m61_set_limit(limit), m61_set_limit(limit, tag),
+/// m61_set_site_limit(limit, file, line)
+///    Set soft and hard limits on active bytes, globally, for a tag, or
+///    for one allocation site.
+
+void m61_set_limit(m61_limit limit) {
+    global_limit=limit;
+    global_over_soft=0;
+    checks_enabled=1;
+}
+
+void m61_set_limit(m61_limit limit, const char* tag) {
+    m61_tag& t=meta_tag_stats[tag];
+    t.limit=limit;
+    t.over_soft=0;
+    checks_enabled=1;
+}
+
+void m61_set_site_limit(m61_limit limit, const char* file, long line) {
+    m61_site& site=meta_site[{file,line}];
+    site.limit=limit;
+    site.over_soft=0;
+    checks_enabled=1;
+}
+
+
+/// m61_set_fail_injection(inj)
+///    Configure injected allocation failures.
+
+void m61_set_fail_injection(const m61_fail_injection& inj) {
+    injection=inj;
+    ninjection_calls=0;
+    //xorshift must not start at zero:
+    injection_rng=inj.seed*0x9E3779B97F4A7C15ULL+1;
+    checks_enabled=1;
+}
+
+
 /// m61_print_statistics()
 ///    Print the current memory statistics.
 
@@ -258,21 +457,70 @@ void m61_print_leak_report() {
 }
 
 
+//sorted_sites()
+//    Return the entries of meta_site ordered by file name, then line, so
+//    reports come out in the same order on every run.
+
+static vector<const pair<const pair<const char*,long>, m61_site>*> sorted_sites() {
+    vector<const pair<const pair<const char*,long>, m61_site>*> sites;
+    for (auto& it:meta_site){
+        sites.push_back(&it);
+    }
+    sort(sites.begin(),sites.end(),[](auto a, auto b){
+        int c=strcmp(a->first.first,b->first.first);
+        return c<0 || (c==0 && a->first.second<b->first.second);
+    });
+    return sites;
+}
+
+
 /// m61_print_heavy_hitter_report()
 ///    Print a report of heavily-used allocation locations.
 
 void m61_print_heavy_hitter_report() {
     // Your heavy-hitters code here
-	for (auto it:meta_hh){
+	for (auto site:sorted_sites()){
+        auto& it=*site;
 
         //Check for Memory heavy hitter:
-		if (10*it.second.first.first>2*total_size){
-			cout<<"HEAVY HITTER: "<<it.second.second<<":"<<it.first<<": "<<it.second.first.first<<" bytes (~"<<(double)it.second.first.first/total_size*100.0<<"%)"<<endl;
+		if (10*it.second.total_size>2*total_size){
+			cout<<"HEAVY HITTER: "<<it.first.first<<":"<<it.first.second<<": "<<it.second.total_size<<" bytes (~"<<(double)it.second.total_size/total_size*100.0<<"%)"<<endl;
 		}
 
         //Check for frequent heavy hitter:
-		if (10*it.second.first.second>2*ntotal){
-			cout<<"HEAVY HITTER: "<<it.second.second<<":"<<it.first<<": "<<it.second.first.second<<" allocations (~"<<(double)it.second.first.second/ntotal*100.0<<"%)"<<endl;
+		if (10*it.second.ntotal>2*ntotal){
+			cout<<"HEAVY HITTER: "<<it.first.first<<":"<<it.first.second<<": "<<it.second.ntotal<<" allocations (~"<<(double)it.second.ntotal/ntotal*100.0<<"%)"<<endl;
 		}
 	}
 }
+
+
+/// m61_print_heap_profile(f, which)
+///    Print per-site allocation data to `f` in collapsed-stack format.
+
+void m61_print_heap_profile(FILE* f, m61_profile_value which) {
+    //Each site becomes a two-frame stack, FILE;FILE:LINE, so flame graphs
+    //group the sites of one file together:
+	for (auto site:sorted_sites()){
+        auto& it=*site;
+        unsigned long long value;
+        switch (which){
+        case M61_PROFILE_NACTIVE:
+            value=it.second.nactive;
+            break;
+        case M61_PROFILE_TOTAL_SIZE:
+            value=it.second.total_size;
+            break;
+        case M61_PROFILE_NTOTAL:
+            value=it.second.ntotal;
+            break;
+        default:
+            value=it.second.active_size;
+            break;
+        }
+        //Skip sites with nothing to report:
+        if (value==0) continue;
+        fprintf(f,"%s;%s:%ld %llu\n",it.first.first,it.first.first,it.first.second,value);
+	}
+    fflush(f);
+}
@@ -39,6 +39,66 @@ struct m61_statistics {
 ///    Store the current memory statistics in `*stats`.
 void m61_get_statistics(m61_statistics* stats);
 
+/// m61_get_statistics(stats, tag)
+///    Store the statistics for allocations made while `tag` was the
+///    innermost active `m61_scope_tag` in `*stats`. `heap_min` and
+///    `heap_max` describe the whole heap. Unknown tags report zeros.
+void m61_get_statistics(m61_statistics* stats, const char* tag);
+
+/// m61_scope_tag
+///    While an `m61_scope_tag` object is alive, every allocation made by
+///    the current thread is attributed to its tag (in addition to the
+///    global statistics). Tags nest: destroying the object restores the
+///    enclosing tag. Tags with equal names share statistics.
+class m61_scope_tag {
+public:
+    explicit m61_scope_tag(const char* tag);
+    ~m61_scope_tag();
+    m61_scope_tag(const m61_scope_tag&) = delete;
+    m61_scope_tag& operator=(const m61_scope_tag&) = delete;
+private:
+    struct m61_tag* prev_;
+};
+
+/// m61_limit
+///    Limits on active bytes. An allocation that would push active bytes
+///    above `hard` fails (and counts in `nfail`/`fail_size`). Crossing
+///    `soft` prints a single `MEMORY WARNING` to stderr until active bytes
+///    drop back under it. 0 means no limit.
+struct m61_limit {
+    unsigned long long soft;
+    unsigned long long hard;
+};
+
+/// m61_set_limit(limit)
+///    Limit active bytes across the whole heap.
+void m61_set_limit(m61_limit limit);
+
+/// m61_set_limit(limit, tag)
+///    Limit active bytes allocated under `tag` (see `m61_scope_tag`).
+void m61_set_limit(m61_limit limit, const char* tag);
+
+/// m61_set_site_limit(limit, file, line)
+///    Limit active bytes allocated at `file`:`line`. `file` must be the
+///    same string the allocation site passes (normally its `__FILE__`).
+void m61_set_site_limit(m61_limit limit, const char* file, long line);
+
+/// m61_fail_injection
+///    Injected allocation failures. After `after` allocation attempts,
+///    every `every`th attempt fails, and each other attempt fails with
+///    probability `probability`, drawn from a generator seeded by `seed`.
+///    Zero `every` and `probability` disable injection.
+struct m61_fail_injection {
+    unsigned long long after;
+    unsigned long long every;
+    double probability;
+    unsigned long long seed;
+};
+
+/// m61_set_fail_injection(inj)
+///    Configure injected failures; also restarts the attempt count.
+void m61_set_fail_injection(const m61_fail_injection& inj);
+
 /// m61_print_statistics()
 ///    Print the current memory statistics.
 void m61_print_statistics();
@@ -52,6 +112,22 @@ void m61_print_leak_report();
 ///    Print a report of heavily-used allocation locations.
 void m61_print_heavy_hitter_report();
 
+/// m61_profile_value
+///    Which per-site quantity a heap profile reports.
+enum m61_profile_value {
+    M61_PROFILE_ACTIVE_SIZE,            // # bytes in active allocations
+    M61_PROFILE_NACTIVE,                // # active allocations
+    M61_PROFILE_TOTAL_SIZE,             // # bytes in total allocations
+    M61_PROFILE_NTOTAL                  // # total allocations
+};
+
+/// m61_print_heap_profile(f, which)
+///    Print a heap profile to `f` in collapsed-stack text format: one
+///    `FILE;FILE:LINE VALUE` line per allocation site, where VALUE is
+///    selected by `which`. The output can be fed directly to
+///    `flamegraph.pl` or speedscope. Sites whose value is zero are omitted.
+void m61_print_heap_profile(FILE* f, m61_profile_value which = M61_PROFILE_ACTIVE_SIZE);
+
 /// `m61.cc` should use these functions rather than malloc() and free().
 void* base_malloc(size_t sz);
 void base_free(void* ptr);
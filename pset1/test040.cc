@@ -0,0 +1,28 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Heap profile in collapsed-stack format.
+
+int main() {
+    void* ptrs[10];
+    for (int i = 0; i != 10; ++i) {
+        ptrs[i] = malloc(100);
+    }
+    void* big = malloc(2000);
+    for (int i = 0; i != 6; ++i) {
+        free(ptrs[i]);
+    }
+    free(big);
+    void* small = malloc(7);
+    (void) small;
+
+    m61_print_heap_profile(stdout);
+    m61_print_heap_profile(stdout, M61_PROFILE_NTOTAL);
+}
+
+//! test040.cc;test040.cc:10 400
+//! test040.cc;test040.cc:17 7
+//! test040.cc;test040.cc:10 10
+//! test040.cc;test040.cc:12 1
+//! test040.cc;test040.cc:17 1
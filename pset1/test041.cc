@@ -0,0 +1,53 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Per-tag statistics with nested m61_scope_tag objects.
+
+static void print_tag(const char* tag) {
+    m61_statistics stat;
+    m61_get_statistics(&stat, tag);
+    printf("%s: active %llu/%llu total %llu/%llu fail %llu/%llu\n", tag,
+           stat.nactive, stat.active_size, stat.ntotal, stat.total_size,
+           stat.nfail, stat.fail_size);
+}
+
+int main() {
+    void* untagged = malloc(10);
+    void* parser;
+    void* lexer;
+    {
+        m61_scope_tag tag("parser");
+        parser = malloc(100);
+        free(malloc(50));
+        {
+            m61_scope_tag inner("lexer");
+            lexer = malloc(20);
+            void* fail = malloc((size_t) -1);
+            assert(!fail);
+        }
+        void* more = calloc(4, 25);
+        free(more);
+    }
+    void* untagged2 = malloc(30);
+
+    print_tag("parser");
+    print_tag("lexer");
+    print_tag("unknown");
+    free(parser);
+    free(lexer);
+    print_tag("parser");
+    print_tag("lexer");
+
+    free(untagged);
+    free(untagged2);
+    m61_print_statistics();
+}
+
+//! parser: active 1/100 total 3/250 fail 0/0
+//! lexer: active 1/20 total 1/20 fail 1/18446744073709551615
+//! unknown: active 0/0 total 0/0 fail 0/0
+//! parser: active 0/0 total 3/250 fail 0/0
+//! lexer: active 0/0 total 1/20 fail 1/18446744073709551615
+//! alloc count: active          0   total          6   fail          1
+//! alloc size:  active          0   total        310   fail ???
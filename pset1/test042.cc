@@ -0,0 +1,44 @@
+#include "m61.hh"
+#include <cstdio>
+#include <cassert>
+#include <cstring>
+// Hard and soft limits and injected allocation failures.
+
+int main() {
+    m61_set_limit({1000, 2000});
+    void* a = malloc(900);
+    void* b = malloc(900);          // crosses soft limit
+    void* c = malloc(900);          // over hard limit
+    assert(a && b && !c);
+    free(b);
+
+    {
+        m61_set_limit({0, 100}, "small");
+        m61_scope_tag tag("small");
+        void* d = malloc(60);
+        void* e = malloc(60);       // over tag limit
+        assert(d && !e);
+        free(d);
+    }
+
+    m61_set_site_limit({0, 10}, __FILE__, __LINE__ + 1);
+    void* f = malloc(11);           // over site limit
+    assert(!f);
+    free(a);
+
+    m61_set_fail_injection({2, 3, 0, 0});
+    int nok = 0;
+    for (int i = 0; i != 9; ++i) {
+        void* g = malloc(1);
+        nok += g != nullptr;
+        free(g);
+    }
+    printf("%d of 9 succeeded\n", nok);
+    m61_set_fail_injection({0, 0, 0, 0});
+    m61_print_statistics();
+}
+
+//! MEMORY WARNING: test???.cc:10: heap active size 1800 exceeds soft limit 1000
+//! 7 of 9 succeeded
+//! alloc count: active          0   total         10   fail          5
+//! alloc size:  active          0   total       1867   fail        973
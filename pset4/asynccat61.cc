@@ -0,0 +1,39 @@
+#include "io61.hh"
+
+// Usage: ./asynccat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE in blocks, with both files in
+//    asynchronous mode: a helper thread per file reads ahead of the copy
+//    and writes out behind it. Fails if either file cannot be put in
+//    asynchronous mode. Default BLOCKSIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = new char[block_size];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    if (io61_async(inf) < 0 || io61_async(outf) < 0) {
+        fprintf(stderr, "io61_async failed\n");
+        exit(1);
+    }
+
+    // Copy file data
+    while (1) {
+        ssize_t amount = io61_read(inf, buf, block_size);
+        if (amount <= 0) {
+            break;
+        }
+        io61_write(outf, buf, amount);
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+}
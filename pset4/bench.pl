@@ -0,0 +1,263 @@
+#! /usr/bin/perl -w
+
+# bench.pl
+#    This program sweeps the test programs over a grid of input sizes,
+#    block sizes (-b) and strides (-t), running the io61, stdio and slow
+#    build of each. It prints one table per test, with the median time
+#    of each build, io61's speedup over stdio and slow, and the system
+#    calls per megabyte reported by io61's profile counters.
+#
+#    Usage: perl bench.pl [TEST...]
+#    Environment variables:
+#       SIZES      input sizes in bytes (default "4096 1000000 20000000");
+#                  suffixes k, m and g multiply by 2^10, 2^20 and 2^30
+#       BLOCKS     block sizes for tests taking -b (default "1 512 65536")
+#       STRIDES    strides for tests taking -t (default "1024 65536")
+#       TRIALS     trials per run; the median is reported (default 3)
+#       MAXTIME    seconds before a run is killed (default 20)
+#       NOMAKE     do not build the test programs first
+#       BENCHLOG   append one JSON line per run to this file, so results
+#                  can be compared over time
+
+use Time::HiRes;
+use POSIX;
+
+sub nonemptyenv ($) {
+    my($e) = @_;
+    return exists($ENV{$e}) && $ENV{$e} ne "" && $ENV{$e} ne " ";
+}
+sub boolenv ($) {
+    my($e) = @_;
+    return nonemptyenv($e) && $ENV{$e} ne "0";
+}
+sub sizeenv ($$) {
+    my($e, $default) = @_;
+    my(@x) = split(/[\s,]+/, nonemptyenv($e) ? $ENV{$e} : $default);
+    foreach my $x (@x) {
+        die "bad $e value \"$x\"\n" if $x !~ m{\A(\d+)([kmg]?)\z}i;
+        $x = $1 * {"" => 1, "k" => 1 << 10, "m" => 1 << 20, "g" => 1 << 30}->{lc($2)};
+    }
+    return grep { $_ > 0 } @x;
+}
+my(@SIZES) = sizeenv("SIZES", "4096 1000000 20000000");
+my(@BLOCKS) = sizeenv("BLOCKS", "1 512 65536");
+my(@STRIDES) = sizeenv("STRIDES", "1024 65536");
+my($TRIALS) = nonemptyenv("TRIALS") ? int($ENV{"TRIALS"}) : 3;
+$TRIALS = 3 if $TRIALS <= 0;
+my($MAXTIME) = nonemptyenv("MAXTIME") ? $ENV{"MAXTIME"} + 0 : 20;
+$MAXTIME = 20 if $MAXTIME <= 0;
+my($NOMAKE) = boolenv("NOMAKE");
+my($BENCHLOG) = nonemptyenv("BENCHLOG") ? $ENV{"BENCHLOG"} : undef;
+eval { require "syscall.ph" };
+
+my($Red, $Green, $Cyan, $Off) = ("\x1b[01;31m", "\x1b[01;32m", "\x1b[01;36m", "\x1b[0m");
+$Red = $Green = $Cyan = $Off = "" if !-t STDOUT;
+
+$SIG{"CHLD"} = sub {};
+
+sub decache ($) {
+    my($fn) = @_;
+    if (defined(&{"SYS_fadvise64"}) && open(DECACHE, "<", $fn)) {
+        syscall &SYS_fadvise64, fileno(DECACHE), 0, -s DECACHE, 4;
+        close(DECACHE);
+    }
+}
+
+# makefile(size)
+#    Return the name of a text input file of `size` bytes, creating it
+#    from the dictionary (or from generated words) if necessary.
+sub makefile ($) {
+    my($size) = @_;
+    my($filename) = "files/bench$size.txt";
+    return $filename if -r $filename && -s $filename == $size;
+    mkdir("files");
+    my($text) = "";
+    if (open(WORDS, "<", "/usr/share/dict/words")) {
+        local $/;
+        $text = <WORDS>;
+        close(WORDS);
+    }
+    if ($text eq "") {
+        my($seed) = 61;
+        for (my $i = 0; $i < 50000; ++$i) {
+            $seed = ($seed * 1103515245 + 12345) % 2147483648;
+            $text .= "word" . ($seed % 100000) . ($i % 7 ? " " : "\n");
+        }
+    }
+    open(OUT, ">", $filename) or die "$filename: $!\n";
+    for (my $n = 0; $n < $size; $n += length($text)) {
+        print OUT substr($text, 0, $size - $n);
+    }
+    close(OUT);
+    return $filename;
+}
+
+# options(program)
+#    Return a hash of the options `program` takes, parsed from its usage
+#    message, or undef if it does not take a FILE and -o OUTFILE.
+my(%options);
+sub options ($) {
+    my($prog) = @_;
+    if (!exists($options{$prog})) {
+        my($usage) = scalar(`./$prog -? 2>&1 </dev/null`);
+        my(%o) = map { ($_ => 1) } ($usage =~ m{\[(-[a-z])\b}g);
+        $options{$prog} = $usage =~ /\[FILE/ && $o{"-o"} ? \%o : undef;
+    }
+    return $options{$prog};
+}
+
+# run1(command)
+#    Run `command` once, with its profile report redirected to a file,
+#    and return a hash of the report's members. The hash has a "killed"
+#    member if the command timed out or failed.
+sub run1 (@) {
+    my(@command) = @_;
+    open(REPORT, "+>", "files/benchreport.json") or die "files/benchreport.json: $!\n";
+    my($before) = Time::HiRes::time();
+    my($pid) = fork();
+    if ($pid == 0) {
+        POSIX::dup2(fileno(REPORT), 100);
+        open(STDOUT, ">", "/dev/null");
+        { exec(@command) };
+        exit(127);
+    }
+    my($status);
+    while (waitpid($pid, WNOHANG) <= 0) {
+        if (Time::HiRes::time() > $before + $MAXTIME) {
+            kill 9, $pid;
+            waitpid($pid, 0);
+            close(REPORT);
+            return {"killed" => sprintf("timeout after %.2fs", $MAXTIME)};
+        }
+        Time::HiRes::usleep(2000);
+    }
+    $status = $?;
+    my($t) = {"time" => Time::HiRes::time() - $before};
+    seek(REPORT, 0, 0);
+    my($buf) = join("", <REPORT>);
+    close(REPORT);
+    while ($buf =~ m,\"(.*?)\"\s*:\s*([\d.]+),g) {
+        $t->{$1} = $2 + 0;
+    }
+    $t->{"killed"} = "exit status " . ($status >> 8) if $status & 0xFFFF;
+    return $t;
+}
+
+# run(command)
+#    Run `command` $TRIALS times and return the median trial.
+sub run (@) {
+    my(@command) = @_;
+    my(@trials);
+    foreach my $i (1..$TRIALS) {
+        foreach my $f (grep { m{^files/bench\d+\.txt$} } @command) {
+            decache($f);
+        }
+        my($t) = run1(@command);
+        return $t if exists($t->{"killed"});
+        push @trials, $t;
+    }
+    @trials = sort { $a->{"time"} <=> $b->{"time"} } @trials;
+    return $trials[int(@trials / 2)];
+}
+
+sub maybe_make ($) {
+    my($prog) = @_;
+    return -x $prog if $NOMAKE;
+    return system("make -s $prog >/dev/null 2>&1") == 0 && -x $prog;
+}
+
+sub fmt_time ($) {
+    my($t) = @_;
+    return !defined($t) ? "-" : exists($t->{"killed"}) ? "KILLED" : sprintf("%.4fs", $t->{"time"});
+}
+
+sub fmt_speedup ($$) {
+    my($t, $base) = @_;
+    return sprintf("%-9s", "-") if !defined($t) || !defined($base)
+        || exists($t->{"killed"}) || exists($base->{"killed"});
+    my($x) = $base->{"time"} / ($t->{"time"} > 0 ? $t->{"time"} : 1e-6);
+    my($color) = $x >= 1 ? $Green : $Red;
+    return sprintf("%s%.2fx%s", $color, $x, $Off)
+        . " " x (9 - length(sprintf("%.2fx", $x)));
+}
+
+# log_run(test, variant, size, block, stride, t)
+#    Append a run to $BENCHLOG.
+my($rev);
+sub log_run ($$$$$$) {
+    my($test, $variant, $size, $block, $stride, $t) = @_;
+    return if !defined($BENCHLOG) || !defined($t);
+    $rev = `git rev-parse --short HEAD 2>/dev/null` if !defined($rev);
+    chomp $rev;
+    my(@m) = ("\"date\":" . time(), "\"rev\":\"$rev\"", "\"test\":\"$test\"",
+              "\"variant\":\"$variant\"", "\"size\":$size");
+    push @m, "\"block\":$block" if defined($block);
+    push @m, "\"stride\":$stride" if defined($stride);
+    if (exists($t->{"killed"})) {
+        push @m, "\"killed\":\"" . $t->{"killed"} . "\"";
+    } else {
+        push @m, map { "\"$_\":" . $t->{$_} } sort(keys(%$t));
+    }
+    open(LOG, ">>", $BENCHLOG) or die "$BENCHLOG: $!\n";
+    print LOG "{", join(", ", @m), "}\n";
+    close(LOG);
+}
+
+# find the tests
+my(@tests);
+if (open(MAKEFILE, "<", "GNUmakefile")) {
+    my($text) = join("", <MAKEFILE>);
+    close(MAKEFILE);
+    $text =~ s{\\\n}{ }g;
+    @tests = split(/\s+/, $1) if $text =~ m{^TESTS\s*=\s*(.*)$}m;
+    push @tests, split(/\s+/, $1) if $text =~ m{^IO61TESTS\s*=\s*(.*)$}m;
+}
+@tests = @ARGV if @ARGV;
+
+foreach my $test (@tests) {
+    if (!maybe_make($test) || !defined(options($test))) {
+        print "${Cyan}$test${Off}: skipped (cannot build, or takes no FILE and -o OUTFILE)\n\n";
+        next;
+    }
+    my($o) = options($test);
+    my(@variants) = ([$test, "io61"]);
+    foreach my $v ("stdio", "slow") {
+        push @variants, ["$v-$test", $v] if maybe_make("$v-$test");
+    }
+    my(@blocks) = $o->{"-b"} ? @BLOCKS : (undef);
+    my(@strides) = $o->{"-t"} ? @STRIDES : (undef);
+
+    print "${Cyan}$test${Off}", (@variants > 1 ? "" : " (no stdio or slow build)"), "\n";
+    printf("%10s %7s %7s  %-10s %-10s %-10s %-9s %-9s %s\n",
+           "SIZE", "BLOCK", "STRIDE", "IO61", "STDIO", "SLOW",
+           "VS STDIO", "VS SLOW", "SYSCALLS/MB");
+    foreach my $size (@SIZES) {
+        my($infile) = makefile($size);
+        foreach my $block (@blocks) {
+            foreach my $stride (@strides) {
+                my(%t);
+                foreach my $v (@variants) {
+                    my(@command) = ("./" . $v->[0]);
+                    push @command, "-b", $block if defined($block);
+                    push @command, "-t", $stride if defined($stride);
+                    push @command, "-o", "files/benchout.txt", $infile;
+                    $t{$v->[1]} = run(@command);
+                    log_run($test, $v->[1], $size, $block, $stride, $t{$v->[1]});
+                }
+                my($io61) = $t{"io61"};
+                my($scmb) = "-";
+                if (!exists($io61->{"killed"}) && exists($io61->{"syscalls"})) {
+                    $scmb = sprintf("%.1f", $io61->{"syscalls"} / ($size / 1048576));
+                }
+                printf("%10d %7s %7s  %-10s %-10s %-10s %s %s %s\n",
+                       $size, defined($block) ? $block : "-",
+                       defined($stride) ? $stride : "-",
+                       fmt_time($io61), fmt_time($t{"stdio"}), fmt_time($t{"slow"}),
+                       fmt_speedup($io61, $t{"stdio"}), fmt_speedup($io61, $t{"slow"}),
+                       $scmb);
+            }
+        }
+    }
+    print "\n";
+}
+unlink("files/benchout.txt", "files/benchreport.json");
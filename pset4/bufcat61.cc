@@ -0,0 +1,48 @@
+#include "io61.hh"
+
+// Usage: ./bufcat61 [-b BUFSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE a character at a time through io61
+//    caches of BUFSIZE bytes, set with io61_setbuf (which also stops
+//    io61 from mapping FILE). Every 1 MiB the caches of both files are
+//    resized, alternating between 4096 and BUFSIZE bytes; on a pipe the
+//    input's resize fails until its cache is used up, and is skipped.
+//    Default BUFSIZE is 65536.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t buf_size = args.block_size ? args.block_size : 65536;
+
+    // Open files, set cache sizes
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    if (io61_setbuf(inf, buf_size) < 0 || io61_setbuf(outf, buf_size) < 0) {
+        fprintf(stderr, "io61_setbuf failed\n");
+        exit(1);
+    }
+
+    // Copy file data
+    size_t n = 0;
+    bool small = false;
+    while (1) {
+        int ch = io61_readc(inf);
+        if (ch == EOF) {
+            break;
+        }
+        io61_writec(outf, ch);
+        if (++n % (1 << 20) == 0) {
+            small = !small;
+            io61_setbuf(inf, small ? 4096 : buf_size);
+            if (io61_setbuf(outf, small ? 4096 : buf_size) < 0) {
+                fprintf(stderr, "io61_setbuf failed\n");
+                exit(1);
+            }
+        }
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+}
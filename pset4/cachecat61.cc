@@ -0,0 +1,37 @@
+#include "io61.hh"
+
+// Usage: ./cachecat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE...]
+//    Copies each input FILE to OUTFILE in turn, in blocks, with the
+//    process-wide block cache on, so a FILE named more than once is read
+//    from disk once. Default BLOCKSIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:#");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open output
+    char* buf = new char[block_size];
+
+    io61_profile_begin();
+    io61_block_cache(64 << 20);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Copy file data
+    for (const char* input_file : args.input_files) {
+        io61_file* inf = io61_open_check(input_file, O_RDONLY);
+        while (1) {
+            ssize_t amount = io61_read(inf, buf, block_size);
+            if (amount <= 0) {
+                break;
+            }
+            io61_write(outf, buf, amount);
+        }
+        io61_close(inf);
+    }
+
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+}
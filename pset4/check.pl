@@ -8,7 +8,12 @@
 #    check.pl will kill it.
 #
 #    To add tests of your own, scroll down to the bottom. It should
-#    be relatively clear what to do.
+#    be relatively clear what to do. Options to `enqueue`:
+#      "io61_only" => 1     The program uses io61 extensions, so it has no
+#                           stdio version to run or compare against.
+#      "expect" => [FILES]  The (single) output file must equal the
+#                           concatenation of FILES, and the command must
+#                           exit with status 0.
 
 use Time::HiRes qw(gettimeofday);
 use Fcntl qw(F_GETFL F_SETFL O_NONBLOCK);
@@ -150,7 +155,9 @@ sub run_sh61 ($;%) {
         exit(1);
     }
 
-    POSIX::setpgid($run61_pid, $run61_pid) or die("setpgid: $!\n");
+    # (EACCES: the child already set its group and ran exec)
+    POSIX::setpgid($run61_pid, $run61_pid) or $! == EACCES
+        or die("setpgid: $!\n");
 
     my($before) = Time::HiRes::time();
     my($died) = 0;
@@ -287,10 +294,12 @@ sub read_triallog ($) {
 
 sub maybe_make ($) {
     my($command) = @_;
-    if (!$NOMAKE && $command =~ m<(?:^|[|&;]\s*)./(\S+)>) {
+    my(@progs) = $command =~ m<(?:^|[|&;]\s*)./(\S+)>g;
+    if (!$NOMAKE && @progs) {
+        my($progs) = join(" ", @progs);
         $verbose = defined($ENV{"V"}) && $ENV{"V"} && $ENV{"V"} ne "0";
-        if (system($verbose ? "make $1" : "make -s $1") != 0) {
-            print STDERR "${Red}ERROR: Cannot make $1${Off}\n";
+        if (system($verbose ? "make $progs" : "make -s $progs") != 0) {
+            print STDERR "${Red}ERROR: Cannot make $progs${Off}\n";
             exit 1;
         }
     }
@@ -330,6 +339,8 @@ sub enqueue ($$$%) {
     my($outsuf) = ".txt";
     $outsuf = ".bin" if $command =~ m<out\.bin>;
     my($no_content_check) = exists($opt{"no_content_check"});
+    my($io61_only) = exists($opt{"io61_only"}) && $opt{"io61_only"};
+    my($expect) = exists($opt{"expect"}) ? $opt{"expect"} : undef;
 
     # prepare stdio command
     my($stdiocmd) = $command;
@@ -347,7 +358,7 @@ sub enqueue ($$$%) {
     while ($stdiocmd =~ m{([^\s<>]*baseout\d*\.(?:txt|bin))}g) {
         push @{$stdio_qitem->{"outfiles"}}, $1;
     }
-    for (my $i = 0; !$NOSTDIO && $i < $STDIOTRIALS; ++$i) {
+    for (my $i = 0; !$NOSTDIO && !$io61_only && $i < $STDIOTRIALS; ++$i) {
         push @workq, $stdio_qitem;
     }
 
@@ -371,7 +382,7 @@ sub enqueue ($$$%) {
         "count" => 0, "elapsed" => 0, "errors" => 0, "nleft" => $TRIALS,
         "infiles" => \@infiles, "outfiles" => [],
         "insize" => $insize, "check_max_size" => 1, "opt" => \%opt,
-        "no_content_check" => $no_content_check
+        "no_content_check" => $no_content_check, "expect" => $expect
     };
     while ($command =~ m{([^\s<>]*out\d*\.(?:txt|bin))}g) {
         push @{$your_qitem->{"outfiles"}}, $1;
@@ -379,7 +390,7 @@ sub enqueue ($$$%) {
     for (my $i = 0; !$NOYOURCODE && $i < $TRIALS; ++$i) {
         push @workq, $your_qitem;
     }
-    $command_trials{$command} = ($NOSTDIO ? 0 : $STDIOTRIALS)
+    $command_trials{$command} = ($NOSTDIO || $io61_only ? 0 : $STDIOTRIALS)
         + ($NOYOURCODE ? 0 : $TRIALS);
 }
 
@@ -470,6 +481,15 @@ sub median_trial ($$$;$) {
                     $tt->{"different_content"} = " ($r)" if $?;
                 }
             }
+            if (exists($tcompar->{"expect_check"})) {
+                my($fname, @expect) = @{$tcompar->{"expect_check"}};
+                my($r) = scalar(`cat @expect | cmp - $fname 2>&1`);
+                chomp $r if $r;
+                $r =~ s/^cmp: // if $r;
+                $tt->{"different_content"} = " ($r)" if $?;
+                $tt->{"different_content"} = " (exit status " . ($tt->{"status"} >> 8) . ")"
+                    if exists($tt->{"status"}) && ($tt->{"status"} >> 8) != 0;
+            }
             if (exists($tcompar->{"md5sum_check"}) && exists($tt->{"md5sum"})) {
                 $tt->{"different_content"} = " (got md5sum " . $tt->{"md5sum"}
                     . ", expected " . $tcompar->{"md5sum_check"} . ")"
@@ -571,7 +591,9 @@ sub run ($) {
             if $stdiot && exists($stdiot->{"outputsize"});
         if (!$NOYOURCODE && !$qitem->{"no_content_check"}) {
             $tcompar->{"content_check"} = $qitem->{"outfiles"}
-                if !$NOSTDIO && $sequentially;
+                if !$NOSTDIO && $sequentially && $stdiot;
+            $tcompar->{"expect_check"} = [$qitem->{"outfiles"}->[0], @{$qitem->{"expect"}}]
+                if $qitem->{"expect"} && $sequentially;
             $tcompar->{"md5sum_check"} = $stdiot->{"md5sum"}
                 if $NOSTDIO && $stdiot && exists($stdiot->{"md5sum"});
         }
@@ -586,6 +608,10 @@ sub run ($) {
                $tt->{"time"}, $tt->{"utime"}, $tt->{"stime"}, $tt->{"maxrss"},
                $tt->{"medianof"}, $tt->{"medianof"} == 1 ? "" : "s");
             push @runtimes, $tt->{"time"};
+            printf("IO61:      %d syscalls, %d refills, %d flushes, %d seeks, %d/%d read cache hits\n",
+                   $tt->{"syscalls"}, $tt->{"refills"}, $tt->{"flushes"}, $tt->{"seeks"},
+                   $tt->{"hits"}, $tt->{"hits"} + $tt->{"misses"})
+                if exists($tt->{"syscalls"});
         }
 
         # print stdio vs. yourcode comparison
@@ -606,9 +632,15 @@ sub run ($) {
         }
         if (exists($tt->{"different_content"})) {
             my(@xoutfiles) = map {s{^files/}{}; $_} @{$qitem->{"outfiles"}};
-            print "    ${Red}ERROR: ", join("+", @xoutfiles),
-                " differs from stdio's ", join("+", map {"base$_"} @xoutfiles),
-                "${Redctx}", $tt->{"different_content"}, "$Off\n";
+            if ($qitem->{"expect"}) {
+                print "    ${Red}ERROR: ", join("+", @xoutfiles),
+                    " differs from ", join("+", @{$qitem->{"expect"}}),
+                    "${Redctx}", $tt->{"different_content"}, "$Off\n";
+            } else {
+                print "    ${Red}ERROR: ", join("+", @xoutfiles),
+                    " differs from stdio's ", join("+", map {"base$_"} @xoutfiles),
+                    "${Redctx}", $tt->{"different_content"}, "$Off\n";
+            }
         }
         ++$nerror if exists($tt->{"different_content"}) || exists($tt->{"different_size"});
 
@@ -692,6 +724,7 @@ $fileinfo{"files/text90k-rev.txt"} = [0, 0, 90 << 10, 2 << 10];
 $fileinfo{"files/binary1meg.bin"} = [0, 0, 1 << 20, 3 << 10];
 $fileinfo{"files/text5meg.txt"} = [0, 0, 5 << 20, 4 << 10];
 $fileinfo{"files/text20meg.txt"} = [0, 0, 20 << 20, 5 << 10];
+$fileinfo{"files/text100k-odd.txt"} = [0, 0, 100007, 6 << 10];
 
 $SIG{"INT"} = sub {
     kill 9, -$run61_pid if $run61_pid;
@@ -857,6 +890,230 @@ enqueue(31,
     "redirected large file, 1B-4KB block I/O, sequential");
 
 
+# PARALLEL I/O
+
+enqueue(32,
+    "./parcat61 -j 4 -o files/out.txt files/text20meg.txt",
+    "regular large file, 64KB block I/O, 4 threads",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+
+# RECORD I/O
+
+enqueue(33,
+    "./recordcat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, 16B record I/O, sequential",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(34,
+    "cat files/text5meg.txt | ./recordcat61 -b 100 | cat > files/out.txt",
+    "piped medium file, 100-record block I/O, sequential",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+enqueue(35,
+    "./recordcat61 -o files/out.txt files/text100k-odd.txt",
+    "regular file ending in a partial record, 16B record I/O",
+    "io61_only" => 1, "expect" => ["files/text100k-odd.txt"]);
+
+enqueue(36,
+    "cat files/text100k-odd.txt | ./recordcat61 -b 7 | cat > files/out.txt",
+    "piped file ending in a partial record, 7-record block I/O",
+    "io61_only" => 1, "expect" => ["files/text100k-odd.txt"]);
+
+
+# NONBLOCKING I/O
+
+enqueue(37,
+    "./pollcat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, 100KB blocks through 16 pipes, one thread",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(38,
+    "cat files/text5meg.txt | ./pollcat61 -j 200 -b 4096 | cat > files/out.txt",
+    "piped medium file, 4KB blocks through 200 pipes, one thread",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+
+
+# SHARED FILE DESCRIPTORS
+
+enqueue(39,
+    "(./cat61 files/text1meg.txt; ./cat61 files/text90k-rev.txt) > files/out.txt",
+    "two programs writing one shared regular file in turn",
+    "expect" => ["files/text1meg.txt", "files/text90k-rev.txt"]);
+
+
+# BLOCK CACHE
+
+enqueue(40,
+    "./cachecat61 -o files/out.txt files/text1meg.txt files/text5meg.txt files/text1meg.txt",
+    "regular files read through the block cache, one read twice",
+    "io61_only" => 1, "expect" => ["files/text1meg.txt", "files/text5meg.txt", "files/text1meg.txt"]);
+
+
+# CACHE SIZES
+
+enqueue(41,
+    "./bufcat61 -b 200000 -o files/out.txt files/text5meg.txt",
+    "regular medium file, byte I/O, caches resized every 1MB",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+enqueue(42,
+    "cat files/text5meg.txt | ./bufcat61 -b 1000000 | cat > files/out.txt",
+    "piped medium file, byte I/O, caches resized every 1MB",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+
+# ASYNCHRONOUS I/O
+
+enqueue(43,
+    "./asynccat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4KB block I/O, helper threads",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(44,
+    "cat files/text5meg.txt | ./asynccat61 -b 777 | cat > files/out.txt",
+    "piped medium file, 777B block I/O, helper threads",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+
+# KERNEL COPIES
+
+enqueue(45,
+    "./copycat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, io61_copy to a regular file",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(46,
+    "./copycat61 -b 100000 files/text5meg.txt | cat > files/out.txt",
+    "regular medium file, 100KB io61_copy calls to a pipe",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+enqueue(47,
+    "cat files/text5meg.txt | ./copycat61 -b 4097 | cat > files/out.txt",
+    "piped medium file, 4097B io61_copy calls to a pipe",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+
+# VECTORED I/O
+
+enqueue(48,
+    "./iovcat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, 4-buffer readv/writev up to 15KB",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(49,
+    "./iovcat61 -b 100000 -o files/out.txt files/text5meg.txt",
+    "regular medium file, 4-buffer readv/writev up to 300KB",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+enqueue(50,
+    "cat files/text5meg.txt | ./iovcat61 -b 30000 | cat > files/out.txt",
+    "piped medium file, 4-buffer readv/writev up to 90KB",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+
+# LINE I/O
+
+enqueue(51,
+    "./linecat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, line I/O",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(52,
+    "./linecat61 -o files/out.txt files/text100k-odd.txt",
+    "regular file ending in a partial line, line I/O",
+    "io61_only" => 1, "expect" => ["files/text100k-odd.txt"]);
+
+enqueue(53,
+    "cat files/text100k-odd.txt | ./linecat61 -b 4096 | cat > files/out.txt",
+    "piped file ending in a partial line, line I/O, 4KB cache",
+    "io61_only" => 1, "expect" => ["files/text100k-odd.txt"]);
+
+enqueue(54,
+    "./linecat61 -b 4096 -o files/out.bin files/binary1meg.bin",
+    "regular binary file, line I/O, 4KB cache",
+    "io61_only" => 1, "expect" => ["files/binary1meg.bin"]);
+
+
+# COMPRESSED I/O
+
+enqueue(55,
+    "./zcat61 -o files/z20meg.bin files/text20meg.txt && ./unzcat61 -o files/out.txt files/z20meg.bin",
+    "regular large file, compressed and decompressed in reverse blocks",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(56,
+    "./zcat61 -b 777 files/text5meg.txt | ./unzcat61 -b 1000 | cat > files/out.txt",
+    "piped medium file, compressed and decompressed through a pipe",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+enqueue(57,
+    "cat files/binary1meg.bin | ./zcat61 | ./unzcat61 -b 100000 > files/out.bin",
+    "piped binary file, compressed and decompressed through pipes",
+    "io61_only" => 1, "expect" => ["files/binary1meg.bin"]);
+
+
+# DUPLEX PIPES
+
+enqueue(58,
+    "./duplexcat61 -o files/out.txt files/text1meg.txt",
+    "regular file, 100B requests to an echo process, no flushes",
+    "io61_only" => 1, "expect" => ["files/text1meg.txt"]);
+
+enqueue(59,
+    "cat files/binary1meg.bin | ./duplexcat61 -b 4096 | cat > files/out.bin",
+    "piped binary file, 4KB requests to an echo process, no flushes",
+    "io61_only" => 1, "expect" => ["files/binary1meg.bin"]);
+
+
+# DIRECT I/O
+
+enqueue(60,
+    "./directcat61 -o files/out.txt files/text20meg.txt",
+    "regular large file, O_DIRECT, 64KB blocks last to first",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(61,
+    "./directcat61 -b 10000 -o files/out.txt files/text100k-odd.txt",
+    "regular odd-sized file, O_DIRECT, unaligned blocks last to first",
+    "io61_only" => 1, "expect" => ["files/text100k-odd.txt"]);
+
+
+# READ-WRITE FILES
+
+enqueue(62,
+    "./rwcat61 -o files/out.txt files/text5meg.txt",
+    "regular medium file, read-write, blocks reversed in place twice",
+    "io61_only" => 1, "expect" => ["files/text5meg.txt"]);
+
+enqueue(63,
+    "cat files/text100k-odd.txt | ./rwcat61 -b 777 -o files/out.txt",
+    "piped odd-sized file, read-write, 777B blocks reversed twice",
+    "io61_only" => 1, "expect" => ["files/text100k-odd.txt"]);
+
+
+# CHECKSUMS
+
+enqueue(64,
+    "./sumcat61 -o files/out.txt files/text20meg.txt",
+    "CRC32C test vectors, then regular large file with checksums",
+    "io61_only" => 1, "expect" => ["files/text20meg.txt"]);
+
+enqueue(65,
+    "cat files/binary1meg.bin | ./sumcat61 -b 777 | cat > files/out.bin",
+    "CRC32C test vectors, then piped binary file with checksums",
+    "io61_only" => 1, "expect" => ["files/binary1meg.bin"]);
+
+
+# PARALLEL I/O AFTER EXISTING OUTPUT
+
+enqueue(66,
+    "{ cat files/text100k-odd.txt; ./parcat61 -j 3 files/text5meg.txt; } > files/out.txt",
+    "odd-sized header, then regular medium file, 64KB block I/O, 3 threads",
+    "io61_only" => 1, "expect" => ["files/text100k-odd.txt", "files/text5meg.txt"]);
+
+
 run($sequentially);
 
 summary();
@@ -0,0 +1,40 @@
+#include "io61.hh"
+#include <cstdint>
+
+// Usage: ./copycat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE with io61_copy, BLOCKSIZE bytes per
+//    call, moving one byte with io61_readc and io61_writec before each
+//    call so that every io61_copy starts with data buffered on both
+//    sides. By default each io61_copy copies all that is left.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : SIZE_MAX;
+
+    // Open files
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Copy file data
+    while (1) {
+        int ch = io61_readc(inf);
+        if (ch == EOF) {
+            break;
+        }
+        io61_writec(outf, ch);
+        ssize_t amount = io61_copy(inf, outf, block_size);
+        if (amount < 0) {
+            perror("io61_copy");
+            exit(1);
+        } else if (amount == 0) {
+            break;
+        }
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+}
@@ -0,0 +1,50 @@
+#include "io61.hh"
+
+// Usage: ./directcat61 [-b BLOCKSIZE] -o OUTFILE FILE
+//    Copies the input FILE to OUTFILE, both opened with O_DIRECT so the
+//    copy bypasses the page cache. Blocks are copied last to first, with
+//    io61_seek on both files, so unaligned BLOCKSIZEs leave io61 to cope
+//    with unaligned heads and tails. Both files must be regular files on
+//    a file system that supports O_DIRECT. Default BLOCKSIZE is 65536.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 65536;
+    if (!args.input_file || !args.output_file) {
+        args.usage();
+        exit(1);
+    }
+
+    // Allocate buffer, open files
+    char* buf = new char[block_size];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY | O_DIRECT);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT);
+
+    // Copy file data, last block first
+    off_t size = io61_filesize(inf);
+    for (off_t pos = (size - 1) / block_size * block_size;
+         size > 0 && pos >= 0; pos -= block_size) {
+        if (io61_seek(inf, pos) < 0 || io61_seek(outf, pos) < 0) {
+            perror("io61_seek");
+            exit(1);
+        }
+        ssize_t amount = io61_read(inf, buf, block_size);
+        if (amount <= 0) {
+            fprintf(stderr, "short read at %lld\n", (long long) pos);
+            exit(1);
+        }
+        io61_write(outf, buf, amount);
+    }
+
+    io61_close(inf);
+    if (io61_close(outf) < 0) {
+        perror("io61_close");
+        exit(1);
+    }
+    io61_profile_end();
+    delete[] buf;
+}
@@ -0,0 +1,116 @@
+#include "io61.hh"
+#include <sys/wait.h>
+
+// Usage: ./duplexcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE through an echo server: a child
+//    process that returns every request it reads over a pair of pipes.
+//    The input is sent in requests of up to BLOCKSIZE bytes (at most
+//    4096), 1 to 8 at a time, and the replies are written to OUTFILE.
+//    Both sides pair their pipe ends with io61_duplex and never call
+//    io61_flush. The client's latency budget cycles through -1, 0 and
+//    200 microseconds every 1000 requests. Default BLOCKSIZE is 100.
+
+static bool read_message(io61_file* f, char* buf, size_t* len) {
+    uint32_t n;
+    if (io61_read(f, (char*) &n, sizeof(n)) != sizeof(n)
+        || n > 4096
+        || io61_read(f, buf, n) != (ssize_t) n) {
+        return false;
+    }
+    *len = n;
+    return true;
+}
+
+static void write_message(io61_file* f, const char* buf, size_t len) {
+    uint32_t n = len;
+    io61_write(f, (const char*) &n, sizeof(n));
+    io61_write(f, buf, len);
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 100;
+    if (block_size > 4096) {
+        args.usage();
+        exit(1);
+    }
+
+    // Start the echo server
+    int request_pipe[2], reply_pipe[2];
+    if (pipe(request_pipe) < 0 || pipe(reply_pipe) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pid_t server = fork();
+    if (server == 0) {
+        close(request_pipe[1]);
+        close(reply_pipe[0]);
+        io61_file* in = io61_fdopen(request_pipe[0], O_RDONLY);
+        io61_file* out = io61_fdopen(reply_pipe[1], O_WRONLY);
+        if (io61_duplex(in, out, -1) < 0) {
+            exit(1);
+        }
+        char buf[4096];
+        size_t len;
+        while (read_message(in, buf, &len)) {
+            write_message(out, buf, len);
+        }
+        io61_close(in);
+        io61_close(out);
+        exit(0);
+    }
+    close(request_pipe[0]);
+    close(reply_pipe[1]);
+
+    // Open files
+    char* buf = new char[block_size];
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    io61_file* requests = io61_fdopen(request_pipe[1], O_WRONLY);
+    io61_file* replies = io61_fdopen(reply_pipe[0], O_RDONLY);
+
+    // Send requests in batches and copy the replies
+    static const long latencies[] = {-1, 0, 200};
+    size_t nsent = 0;
+    bool done = false;
+    while (!done) {
+        int batch = 1 + nsent % 8, nbatch = 0;
+        for (; nbatch < batch; ++nbatch) {
+            if (nsent % 1000 == 0
+                && io61_duplex(replies, requests,
+                               latencies[nsent / 1000 % 3]) < 0) {
+                fprintf(stderr, "io61_duplex failed\n");
+                exit(1);
+            }
+            ssize_t amount = io61_read(inf, buf, block_size);
+            if (amount <= 0) {
+                done = true;
+                break;
+            }
+            write_message(requests, buf, amount);
+            ++nsent;
+        }
+        for (; nbatch > 0; --nbatch) {
+            size_t len;
+            if (!read_message(replies, buf, &len)) {
+                fprintf(stderr, "lost reply\n");
+                exit(1);
+            }
+            io61_write(outf, buf, len);
+        }
+    }
+
+    io61_close(requests);
+    io61_close(replies);
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+
+    int status;
+    waitpid(server, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
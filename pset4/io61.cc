@@ -1,151 +1,2616 @@
 #include "io61.hh"
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <ctime>
+#if __linux__
+#include <sys/sendfile.h>
+#include <sys/epoll.h>
+#endif
+#if __x86_64__
+#include <nmmintrin.h>
+#elif __aarch64__ && __ARM_FEATURE_CRC32
+#include <arm_acle.h>
+#endif
 #include <climits>
+#include <new>
+#include <cstdint>
 #include <cerrno>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
-#define cach_size 16384 //4x4096 looked like a good size
+#define cach_default 16384     //4x4096 looked like a good size
+#define cach_min 4096           //cache sizes are multiples of this
+#define cach_max (64<<20)
+#define cach_big (1<<20)        //for huge sequential files
+#define cach_huge (2<<20)       //caches this big get their own (huge) pages
+#define map_max (256<<20)       //read-only files bigger than this are not mapped
+#define cach_slots 4            //read caches per seekable file; they are cach_size alligned
+#define wslot_budget (16<<20)   //most bytes in dirty write slots per seekable file
+#define pcache_blocks 64        //most blocks in the shared io61_pread cache
+#define bcache_block 16384      //bytes per block of the process-wide block cache
+#define cz_block (64<<10)       //uncompressed bytes per block of a compressed file
+#define cz_magic 0x5a313649     //"I61Z", starts a compressed file
+#define cz_tmagic 0x58313649    //"I61X", ends its block index
+#define cz_trailer 28           //u64 nblocks, u64 index offset, u64 size, u32 magic
+#ifndef O_DIRECT
+#define O_DIRECT 0              //no direct I/O here: every file is buffered
+#endif
 // io61.c
 
 
+// io61_slot
+//    One cach_size alligned block of a seekable read-only file.
+
+struct io61_slot {
+    char* data;
+    off_t tag;      //file offset of data[0]
+    off_t end;      //file offset just past the valid bytes; == tag when empty
+    unsigned long long used;    //io61_file::clock when last used, for LRU
+};
+
+
+// io61_wslot
+//    One cach_size alligned block of a seekable write-only file, with a
+//    bitmap of which of its bytes were written. Read-write files keep the
+//    rest of the block's bytes in it too, so it is their only cache.
+
+struct io61_wslot {
+    char* data;
+    off_t tag;      //file offset of data[0]
+    size_t ndirty;  //number of bits set in `dirty`
+    off_t lo, hi;   //every dirty byte is in data[lo, hi)
+    unsigned long long* dirty;  //one bit per byte of data
+};
+
+
+// io61_async_state
+//    Helper thread for an io61_file in asynchronous mode. It runs one
+//    read or write job at a time while the caller works on the other
+//    half of a double buffer.
+
+struct io61_async_state {
+    std::thread thread;
+    std::mutex m;
+    std::condition_variable cv;
+    bool pending=false;         //a job was submitted and has not finished
+    bool stop=false;
+    //The job:
+    bool write;
+    char* buf;
+    size_t sz;
+    off_t pos;                  //file offset, or -1 for the descriptor's position
+    ssize_t result;
+    //The caller's side:
+    bool running=false;         //whether a job's result is still to be collected
+    bool failed=false;          //an earlier write job failed
+    char* spare=nullptr;        //other half of the double buffer (unseekable files)
+    io61_wslot* slot=nullptr;   //slot being written back (seekable files)
+    io61_slot* rslot=nullptr;   //slot being read ahead (seekable inputs)
+};
+
+
+// io61_stats
+//    Counters of an io61_file. They are added to process-wide totals at
+//    close, which io61_profile_end reports. Bytes moved through the cache
+//    are counted in batches by io61_account, not per call.
+
+struct io61_stats {
+    unsigned long long syscalls=0;  //read, write, seek and copy system calls
+    unsigned long long nread=0;     //bytes returned to the caller
+    unsigned long long nwritten=0;  //bytes taken from the caller
+    unsigned long long hits=0;      //bytes read from the cache (or mapping)
+    unsigned long long misses=0;    //reads that refilled or read directly
+    unsigned long long seeks=0;     //io61_seek calls
+    unsigned long long flushes=0;   //write caches written out
+    unsigned long long refills=0;   //read caches refilled
+};
+
+static io61_stats io61_totals;
+static std::mutex io61_totals_mutex;
+
+// io61_count(c, n)
+//    Add `n` to counter `c`. Safe against the concurrent io61_pread and
+//    io61_pwrite calls; plain increments are used where those cannot run.
+
+static inline void io61_count(unsigned long long& c, unsigned long long n) {
+    __atomic_fetch_add(&c,n,__ATOMIC_RELAXED);
+}
+
+
+// io61_pcache
+//    Block cache of a seekable, unmapped read-only file for io61_pread.
+//    Unlike the slots it is shared by every thread using the file, so
+//    it has its own lock and block size (io61_setbuf leaves it alone).
+
+struct io61_pblock {
+    char* data;
+    off_t end;      //bytes of data that are valid; < block_size at EOF
+    unsigned long long used;
+};
+
+struct io61_pcache {
+    std::mutex m;
+    off_t block_size;
+    std::unordered_map<off_t, io61_pblock> blocks;  //by block number
+    unsigned long long clock=0;
+};
+
+
+// io61_bkey, io61_bblock, io61_bcache
+//    The process-wide block cache (see io61_block_cache). Blocks are keyed
+//    by device, inode, and a version made of the file's modification time
+//    and size, so a file changed since its blocks were read gets new ones;
+//    stale blocks just age out. `ring` is the CLOCK order.
+
+struct io61_bkey {
+    dev_t dev;
+    ino_t ino;
+    long long version;
+    off_t block;
+    bool operator==(const io61_bkey& k) const {
+        return dev==k.dev && ino==k.ino && version==k.version && block==k.block;
+    }
+};
+
+struct io61_bkey_hash {
+    size_t operator()(const io61_bkey& k) const {
+        size_t h=std::hash<unsigned long long>()(k.ino);
+        h=h*31+std::hash<unsigned long long>()(k.dev);
+        h=h*31+std::hash<long long>()(k.version);
+        return h*31+std::hash<long long>()(k.block);
+    }
+};
+
+struct io61_bblock {
+    io61_bkey key;
+    char* data;
+    off_t end;      //bytes of data that are valid; < bcache_block at EOF
+    int pins;       //io61_files reading from this block right now
+    bool ref;       //CLOCK reference bit
+};
+
+struct io61_bcache {
+    std::mutex m;
+    size_t budget=0;    //bytes; 0 means off
+    std::vector<io61_bblock*> ring;
+    size_t hand=0;
+    std::unordered_map<io61_bkey, io61_bblock*, io61_bkey_hash> map;
+};
+
+static io61_bcache io61_bc;
+
+
+// io61_cz
+//    State of an io61_file in compressed mode. The compressed bytes go
+//    through `inner`, an ordinary io61_file on the same descriptor; the
+//    outer file's cache holds one uncompressed block.
+//
+//    Format (integers little-endian, offsets from the start of the frame):
+//    "I61Z", u32 block size; then blocks, each u32 compressed size (top bit
+//    set: stored uncompressed), u32 size, data; then 8 zero bytes; then
+//    the index, a u64 frame offset and u64 uncompressed offset per block;
+//    then u64 number of blocks, u64 index offset, u64 size, "I61X".
+
+struct io61_cz {
+    io61_file* inner;
+    off_t base;         //offset of the frame in `inner`
+    off_t block_size;
+    char* cbuf;         //one compressed block
+    std::vector<std::pair<off_t, off_t>> index;  //(frame offset, uncompressed offset)
+    off_t size;         //uncompressed size, or -1 if there is no index
+    off_t coff;         //frame offset of the next block to read or write
+    bool eof;           //readers: saw the end of the blocks
+    bool bad;           //readers: the frame is corrupt
+};
+
+
 // io61_file
 //    Data structure for io61 file wrappers.
 
 struct io61_file {
     int fd;
+    off_t cach_size;    //bytes per cache (signed, like the tags); see io61_setbuf
     //The cache buffer, tags, and the mode:
-    char cach[cach_size];
+    char* cach;     //points to the current slot's data, or to the whole file if it is mapped
     off_t start_tag;
     off_t end_tag;
+    off_t wend_tag; //writes go to the cache while start_tag<=cur_tag<wend_tag
     off_t cur_tag;
+    off_t sum_tag;  //[sum_tag, cur_tag) moved through the cache but not yet counted; see io61_account
+    off_t fd_tag;   //the file descriptor's own offset (seekable reads use pread instead)
     int mode;
+    bool seekable;
+    bool mapped;    //read-only regular files are mmapped and never refilled (see io61_fdopen)
+    bool shared;    //read-only files not mapped may use the block cache instead of slots
+    bool direct;    //opened with O_DIRECT; see io61_write_run
+    int fdflags;    //the descriptor's status flags, for direct files
+    io61_bkey bkey;         //the file's identity in the block cache
+    io61_bblock* pinned;    //the shared block `cach` points into
+    //The read slots (write-only and unseekable files only use slots[0]):
+    io61_slot slots[cach_slots];
+    int nslots;
+    unsigned long long clock;
+    //Access pattern detection, in blocks of cach_size:
+    off_t last_block;   //last block read by the previous miss
+    off_t stride;       //distance between the last two misses
+    //Seekable write-only files coalesce scattered writes in dirty slots,
+    //and read-write files also read through them. The current slot is
+    //`wcur`; [run_tag, cur_tag) are the bytes written to it since the
+    //last seek, not yet marked in its bitmap:
+    io61_wslot* wcur;
+    off_t run_tag;
+    std::list<io61_wslot*> wlru;    //most recently used first
+    std::unordered_map<off_t, std::list<io61_wslot*>::iterator> wslots;  //by block
+    std::vector<io61_wslot*> wfree;
+    io61_async_state* async;  //non-null in asynchronous mode
+    io61_pcache* pcache;      //seekable unmapped read-only files only
+    std::vector<char> line;   //io61_readline's copy of a line that spans caches
+    io61_cz* cz;              //non-null in compressed mode
+    //Duplex mode (see io61_duplex): the paired file, and for outputs the
+    //latency budget in microseconds and when the oldest buffered byte was
+    //written (0 if unknown or none):
+    io61_file* peer;
+    long latency;
+    long long pending_since;
+    off_t size;     //regular files: the file's size, counting buffered writes
+    //Sparse mode (see io61_sparse) skips writing aligned zero blocks that
+    //read as zeros anyway (past the size when it was turned on, and never
+    //written since); `prealloc` is the end of space io61_preallocate
+    //reserved, given back at close if it was not written:
+    bool sparse;
+    off_t hole_from;    //the size when sparse mode was turned on
+    off_t disk_size;    //the length of the file on disk
+    std::map<off_t, off_t> written;   //extents written since: start -> end
+    off_t prealloc;
+    //Checksum mode (see io61_checksum): where io61_close stores the digest,
+    //and the running CRC32C of the bytes read or written so far:
+    uint32_t* digest;
+    uint32_t crc;
+    //Nonblocking mode (see io61_nonblock), and whether `line` holds the
+    //start of a line io61_readline could not finish:
+    bool nonblock;
+    bool line_more;
+    io61_stats stats;
 };
 
 
+static uint32_t io61_crc32c(uint32_t crc, const char* p, size_t n);
+
+// io61_account(f)
+//    Count the bytes moved through the cache of `f` since the last call,
+//    [sum_tag, cur_tag), as read or written, and add them to the checksum
+//    in checksum mode. io61_readc, io61_writec and the other cache paths
+//    only advance cur_tag; this runs before the cache is refilled,
+//    written out or left, so the counters and the CRC cost nothing per
+//    byte and the CRC runs over whole buffers. Code that moves cur_tag
+//    any other way calls this first and sets sum_tag=cur_tag afterwards.
+
+static void io61_account(io61_file* f) {
+    off_t n=f->cur_tag-f->sum_tag;
+    if (n>0 && f->sum_tag>=f->start_tag){
+        if (f->digest){
+            f->crc=io61_crc32c(f->crc,&f->cach[f->sum_tag-f->start_tag],n);
+        }
+        //Read-write caches are either being read or being written:
+        if (f->mode==O_WRONLY || (f->mode==O_RDWR && f->wend_tag>f->start_tag)){
+            f->stats.nwritten+=n;
+        }
+        else{
+            f->stats.nread+=n;
+            f->stats.hits+=n;
+        }
+    }
+    f->sum_tag=f->cur_tag;
+}
+
+
+// io61_alloc(sz), io61_free(p, sz)
+//    Allocate and free cache memory. It is page-aligned, as O_DIRECT
+//    transfers need. Huge caches come straight from mmap and ask for
+//    transparent huge pages; the rest come from the heap.
+
+static char* io61_alloc(size_t sz) {
+    void* p;
+    if (sz>=cach_huge){
+        p=mmap(nullptr,sz,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+        if (p==MAP_FAILED){
+            throw std::bad_alloc();
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(p,sz,MADV_HUGEPAGE);
+#endif
+    }
+    else if (posix_memalign(&p,cach_min,sz)!=0){
+        throw std::bad_alloc();
+    }
+    return (char*)p;
+}
+
+static void io61_free(char* p, size_t sz) {
+    if (sz>=cach_huge){
+        munmap(p,sz);
+    }
+    else{
+        free(p);
+    }
+}
+
+
+// io61_round_size(sz)
+//    Round a cache size up to a multiple of cach_min within [cach_min, cach_max].
+
+static size_t io61_round_size(size_t sz) {
+    sz=std::max((size_t)cach_min,std::min((size_t)cach_max,sz));
+    return (sz+cach_min-1)/cach_min*cach_min;
+}
+
+
+// io61_auto_size(fd, mode, s)
+//    Pick the cache size for a new io61_file. Pipes get the pipe's own
+//    capacity, small read-only files just their size, read-only files
+//    too big to map cach_big, and everything else at least cach_default
+//    or the file system's preferred block size. `s` is `fd`'s stat, if
+//    known.
+
+static size_t io61_auto_size(int fd, int mode, const struct stat* s) {
+    size_t sz=cach_default;
+    if (!s){
+        return sz;
+    }
+#ifdef F_GETPIPE_SZ
+    if (S_ISFIFO(s->st_mode)){
+        int pipe_sz=fcntl(fd,F_GETPIPE_SZ);
+        if (pipe_sz>0){
+            sz=pipe_sz;
+        }
+        return io61_round_size(sz);
+    }
+#else
+    (void) fd;
+#endif
+    if (S_ISREG(s->st_mode)){
+        sz=std::max(sz,(size_t)s->st_blksize);
+        if (mode==O_RDONLY && s->st_size<(off_t)sz){
+            sz=s->st_size;
+        }
+        else if (mode==O_RDONLY && s->st_size>map_max){
+            sz=cach_big;
+        }
+    }
+    return io61_round_size(sz);
+}
+
+
+// io61_bcache_evict(room)
+//    Evict blocks with the CLOCK algorithm until there is `room` bytes of
+//    budget left. Recently used blocks get a second chance and pinned
+//    blocks are skipped, so this may give up with the cache over budget.
+//    `io61_bc.m` must be held.
+
+static void io61_bcache_evict(size_t room) {
+    io61_bcache& bc=io61_bc;
+    size_t skipped=0;
+    while (!bc.ring.empty() && bc.ring.size()*bcache_block+room>bc.budget
+           && skipped<2*bc.ring.size()){
+        if (bc.hand>=bc.ring.size()){
+            bc.hand=0;
+        }
+        io61_bblock* b=bc.ring[bc.hand];
+        if (b->pins>0 || b->ref){
+            b->ref=false;
+            bc.hand++;
+            skipped++;
+            continue;
+        }
+        bc.map.erase(b->key);
+        bc.ring[bc.hand]=bc.ring.back();
+        bc.ring.pop_back();
+        io61_free(b->data,bcache_block);
+        delete b;
+        skipped=0;
+    }
+}
+
+// io61_block_cache(budget)
+//    Turn on the process-wide block cache for read-only files opened from
+//    now on, with room for `budget` bytes of blocks; 0 turns it off for
+//    files opened later. Blocks are keyed by file identity and block
+//    number, so files opened several times, or by several io61_files, are
+//    read from disk once while their blocks stay cached. While it is on,
+//    new read-only files use it instead of being mapped. Shrinking the
+//    budget evicts blocks at once. Returns 0.
+
+int io61_block_cache(size_t budget) {
+    std::lock_guard<std::mutex> guard(io61_bc.m);
+    io61_bc.budget=budget;
+    io61_bcache_evict(0);
+    return 0;
+}
+
+// io61_bcache_unpin(f)
+//    Let go of the shared block `f` is reading from, if any.
+
+static void io61_bcache_unpin(io61_file* f) {
+    if (f->pinned){
+        std::lock_guard<std::mutex> guard(io61_bc.m);
+        f->pinned->pins--;
+        f->pinned=nullptr;
+    }
+}
+
+// io61_bcache_fill(f)
+//    io61_fill for files using the block cache: point the cache of `f` at
+//    the shared block holding `f->cur_tag`, reading it on a miss (without
+//    the lock held, so other files' hits go ahead). The block stays pinned
+//    while `f` uses it. Returns the number of bytes available after
+//    `f->cur_tag`, 0 at end-of-file, or -1 on error.
+
+static ssize_t io61_bcache_fill(io61_file* f) {
+    io61_bcache& bc=io61_bc;
+    io61_bkey key=f->bkey;
+    key.block=f->cur_tag/bcache_block;
+    io61_bcache_unpin(f);
+    f->start_tag=f->end_tag=f->cur_tag;
+    std::unique_lock<std::mutex> lock(bc.m);
+    auto it=bc.map.find(key);
+    if (it==bc.map.end()){
+        lock.unlock();
+        f->stats.refills++;
+        char* data=io61_alloc(bcache_block);
+        off_t got=0;
+        while (got<bcache_block){
+            f->stats.syscalls++;
+            ssize_t r=pread(f->fd,data+got,bcache_block-got,key.block*bcache_block+got);
+            if (r<0 && errno==EINTR){
+                continue;
+            }
+            if (r<0){
+                io61_free(data,bcache_block);
+                return -1;
+            }
+            if (r==0){
+                break;
+            }
+            got+=r;
+        }
+        lock.lock();
+        it=bc.map.find(key);
+        if (it!=bc.map.end()){
+            //Another file read it first:
+            io61_free(data,bcache_block);
+        }
+        else{
+            io61_bcache_evict(bcache_block);
+            io61_bblock* b=new io61_bblock{key,data,got,0,false};
+            bc.ring.push_back(b);
+            it=bc.map.emplace(key,b).first;
+        }
+    }
+    io61_bblock* b=it->second;
+    b->ref=true;
+    b->pins++;
+    f->pinned=b;
+    f->cach=b->data;
+    f->start_tag=key.block*bcache_block;
+    f->end_tag=f->start_tag+b->end;
+    return f->cur_tag<f->end_tag ? f->end_tag-f->cur_tag : 0;
+}
+
+
+// io61_alloc_slots(f)
+//    Allocate the read slots, or the unseekable write buffer, of `f`.
+//    Seekable write-only files only use write slots, allocated on demand.
+
+static void io61_alloc_slots(io61_file* f) {
+    f->nslots=0;
+    if (f->mapped || f->shared || (f->mode!=O_RDONLY && f->seekable)){
+        return;
+    }
+    f->nslots=(f->mode==O_RDONLY && f->seekable ? cach_slots : 1);
+    char* data=io61_alloc(f->nslots*f->cach_size);
+    for (int i=0; i<f->nslots; i++){
+        f->slots[i].data=data+i*f->cach_size;
+        f->slots[i].tag=f->slots[i].end=0;
+        f->slots[i].used=0;
+    }
+    f->cach=data;
+    if (f->mode!=O_RDONLY){
+        //The unseekable write buffer always has room:
+        f->wend_tag=f->start_tag+f->cach_size;
+    }
+}
+
+
+// io61_free_slots(f)
+//    Free the read slots (or unseekable write buffer) and the write slots
+//    of `f`, which must be clean.
+
+static void io61_free_slots(io61_file* f) {
+    if (f->nslots){
+        //The first slot's data may have been swapped with the async spare;
+        //either way it is the start of a whole allocation:
+        io61_free(f->slots[0].data,f->nslots*f->cach_size);
+    }
+    f->nslots=0;
+    //Read-write files keep their (clean) slots after a flush:
+    f->wfree.insert(f->wfree.end(),f->wlru.begin(),f->wlru.end());
+    f->wlru.clear();
+    f->wslots.clear();
+    f->wcur=nullptr;
+    for (io61_wslot* ws:f->wfree){
+        io61_free(ws->data,f->cach_size);
+        delete[] ws->dirty;
+        delete ws;
+    }
+    f->wfree.clear();
+}
+
+
 // io61_fdopen(fd, mode)
 //    Return a new io61_file for file descriptor `fd`. `mode` is
-//    either O_RDONLY for a read-only file or O_WRONLY for a
-//    write-only file. You need not support read/write files.
+//    O_RDONLY for a read-only file, O_WRONLY for a write-only file, or
+//    O_RDWR for a seekable read-write file, whose reads and writes share
+//    one cache: reads see earlier writes without a flush. Returns nullptr
+//    and sets errno to ESPIPE if `mode` is O_RDWR but `fd` is not
+//    seekable (a socket, pipe or terminal); open such a descriptor as two
+//    io61_files instead, one per direction.
+//    Descriptors opened with O_DIRECT (e.g. io61_open_check with
+//    O_DIRECT in `mode`) bypass the page cache: they get big aligned
+//    caches and are never mapped; see io61_write_run for the bytes
+//    that cannot be transferred directly.
+//    Other regular read-only files of up to 256 MiB are read from a
+//    mapping. If the file is truncated while it is open, touching the
+//    mapped pages past its new end raises SIGBUS, as with any mapping. A
+//    program reading files that others may shrink should call io61_setbuf
+//    right after opening them, which reads them through caches instead.
 
 io61_file* io61_fdopen(int fd, int mode) {
     assert(fd >= 0);
+    //Start from wherever the descriptor already is (e.g. `< file` redirections):
+    off_t pos=lseek(fd,0,SEEK_CUR);
+    if (mode==O_RDWR && pos<0){
+        errno=ESPIPE;
+        return nullptr;
+    }
     io61_file* f = new io61_file;
     f->fd = fd;
     f->mode=mode; //We will need the more in io61_seek
-    f->cur_tag=f->end_tag=f->start_tag=0;
-    (void) mode;
+    f->seekable=pos>=0;
+    f->cur_tag=f->end_tag=f->wend_tag=f->start_tag=f->fd_tag=(f->seekable ? pos : 0);
+    f->sum_tag=f->cur_tag;
+    f->mapped=false;
+    f->shared=false;
+    f->pinned=nullptr;
+    f->cach=nullptr;
+    f->nslots=0;
+    f->fdflags=fcntl(fd,F_GETFL);
+    f->direct=f->fdflags>=0 && (f->fdflags&O_DIRECT);
+    f->clock=0;
+    f->last_block=f->stride=0;
+    f->wcur=nullptr;
+    f->run_tag=f->cur_tag;
+    f->async=nullptr;
+    f->pcache=nullptr;
+    f->cz=nullptr;
+    f->peer=nullptr;
+    f->latency=-1;
+    f->pending_since=0;
+    f->digest=nullptr;
+    f->nonblock=f->line_more=false;
+
+    //Regular read-only files (but direct and huge ones) are served straight
+    //from a mapping of the whole file, so reads and seeks need no system
+    //calls. Huge files are read through slots with read-ahead instead,
+    //rather than mapping more than the page cache may hold:
+    struct stat s;
+    bool have_stat=fstat(fd,&s)>=0;
+    f->cach_size=io61_auto_size(fd,mode,have_stat ? &s : nullptr);
+    f->size=(have_stat && S_ISREG(s.st_mode) ? s.st_size : 0);
+    f->sparse=false;
+    f->hole_from=f->disk_size=f->size;
+    f->prealloc=0;
+    if (f->direct){
+        //Every transfer is a disk request; make them big:
+        f->cach_size=std::max(f->cach_size,(off_t)cach_big);
+    }
+    //While the process-wide block cache is on, they share it instead, so
+    //that files read several times are read from disk once:
+    if (mode==O_RDONLY && f->seekable && !f->direct && have_stat
+        && S_ISREG(s.st_mode)){
+        std::lock_guard<std::mutex> guard(io61_bc.m);
+        f->shared=io61_bc.budget>0;
+        long long mtime=s.st_mtim.tv_sec*1000000000LL+s.st_mtim.tv_nsec;
+        f->bkey={s.st_dev,s.st_ino,mtime*31+s.st_size,0};
+    }
+    if (mode==O_RDONLY && f->seekable && have_stat && !f->direct && !f->shared
+        && S_ISREG(s.st_mode) && s.st_size>0 && s.st_size<=map_max){
+        void* map=mmap(nullptr,s.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+        if (map!=MAP_FAILED){
+            f->cach=(char*)map;
+            f->start_tag=0;
+            f->end_tag=s.st_size;
+            f->mapped=true;
+        }
+    }
+    io61_alloc_slots(f);
+    if (mode==O_RDONLY && f->seekable && !f->mapped){
+        f->pcache=new io61_pcache;
+        f->pcache->block_size=f->cach_size;
+    }
     return f;
 }
 
 
-// io61_close(f)
-//    Close the io61_file `f` and release all its resources.
+// io61_async_main(a, fd)
+//    Body of the helper thread: run jobs until asked to stop.
 
-int io61_close(io61_file* f) {
-    io61_flush(f);
-    int r = close(f->fd);
-    delete f;
+static void io61_async_main(io61_async_state* a, int fd) {
+    std::unique_lock<std::mutex> lock(a->m);
+    while (1){
+        a->cv.wait(lock,[a] { return a->pending || a->stop; });
+        if (!a->pending){
+            return;
+        }
+        lock.unlock();
+        ssize_t r;
+        if (!a->write){
+            do {
+                r=(a->pos>=0 ? pread(fd,a->buf,a->sz,a->pos) : read(fd,a->buf,a->sz));
+            } while (r<0 && errno==EINTR);
+        }
+        else{
+            //Writes must complete, so retry short ones:
+            r=0;
+            while ((size_t)r<a->sz){
+                ssize_t w=(a->pos>=0 ? pwrite(fd,a->buf+r,a->sz-r,a->pos+r)
+                           : write(fd,a->buf+r,a->sz-r));
+                if (w<0 && errno==EINTR){
+                    continue;
+                }
+                if (w<=0){
+                    r=-1;
+                    break;
+                }
+                r+=w;
+            }
+        }
+        lock.lock();
+        a->result=r;
+        a->pending=false;
+        a->cv.notify_all();
+    }
+}
+
+// io61_async_submit(f, write, buf, sz, pos)
+//    Hand a job to the helper thread of `f`. No job may be running.
+
+static void io61_async_submit(io61_file* f, bool write, char* buf, size_t sz, off_t pos) {
+    io61_async_state* a=f->async;
+    assert(!a->running);
+    std::lock_guard<std::mutex> guard(a->m);
+    a->write=write;
+    a->buf=buf;
+    a->sz=sz;
+    a->pos=pos;
+    a->pending=true;
+    a->running=true;
+    a->cv.notify_all();
+}
+
+// io61_async_collect(f)
+//    Wait for the helper thread's job, if any, and return its result
+//    (0 if there was no job).
+
+static ssize_t io61_async_collect(io61_file* f) {
+    io61_async_state* a=f->async;
+    if (!a || !a->running){
+        return 0;
+    }
+    std::unique_lock<std::mutex> lock(a->m);
+    a->cv.wait(lock,[a] { return !a->pending; });
+    a->running=false;
+    f->stats.syscalls++;    //at least; the helper retries short writes
+    return a->result;
+}
+
+// io61_async_wait(f)
+//    Wait until no write job of `f` is in flight, so a synchronous write
+//    can follow it. A finished slot write-back goes back on the free list.
+//    Returns -1 if a write job failed since the last call, 0 otherwise.
+
+static int io61_async_wait(io61_file* f) {
+    io61_async_state* a=f->async;
+    if (!a || !a->running || !a->write){
+        return 0;
+    }
+    if (io61_async_collect(f)<0){
+        a->failed=true;
+    }
+    if (a->slot){
+        memset(a->slot->dirty,0,f->cach_size/8);
+        a->slot->ndirty=0;
+        a->slot->lo=f->cach_size;
+        a->slot->hi=0;
+        f->wfree.push_back(a->slot);
+        a->slot=nullptr;
+    }
+    int r=a->failed ? -1 : 0;
+    a->failed=false;
     return r;
 }
 
-// void io61_fill(io61_file* f)
-void io61_fill(io61_file* f){
-    //Move to the end:
-    f->cur_tag=f->end_tag;
-    //Move end_tag backwards so that it is cach_size alligned:
-    f->end_tag=(f->end_tag/cach_size)*cach_size;
-    //We will start reading from this alligned position:
-    f->start_tag=f->end_tag;
-    lseek(f->fd,f->end_tag,SEEK_SET);
-    int sz=read(f->fd,f->cach,cach_size);
-    if (sz>0)
-        f->end_tag+=sz;
-    else f->end_tag=f->start_tag=f->cur_tag;
+// io61_async_stop(f)
+//    Finish any job, stop the helper thread of `f`, and leave
+//    asynchronous mode.
+
+static void io61_async_stop(io61_file* f) {
+    io61_async_state* a=f->async;
+    io61_async_wait(f);
+    io61_async_collect(f);
+    {
+        std::lock_guard<std::mutex> guard(a->m);
+        a->stop=true;
+        a->cv.notify_all();
+    }
+    a->thread.join();
+    if (a->rslot){
+        //Its read-ahead is dropped; the slot is free again:
+        a->rslot->used=0;
+    }
+    io61_free(a->spare,f->cach_size);
+    delete a;
+    f->async=nullptr;
 }
 
-// io61_readc(f)
-//    Read a single (unsigned) character from `f` and return it. Returns EOF
-//    (which is -1) on error or end-of-file.
 
-int io61_readc(io61_file* f) {
-    //Can we fullfill this read without making system calls:
-    if (f->cur_tag<f->end_tag){
-        unsigned char buf=f->cach[f->cur_tag-f->start_tag];
-        f->cur_tag++;
-        return buf;
+// io61_unmap(f)
+//    Stop serving read-only file `f` from its mapping: from now on it is
+//    read through slots (and io61_pread through a block cache) of
+//    `f->cach_size` bytes, as if it had not been mapped. The caller
+//    allocates the slots.
+
+static void io61_unmap(io61_file* f) {
+    io61_account(f);
+    munmap(f->cach,f->end_tag);
+    f->mapped=false;
+    f->cach=nullptr;
+    f->start_tag=f->end_tag=f->cur_tag;
+    f->pcache=new io61_pcache;
+    f->pcache->block_size=f->cach_size;
+}
+
+
+// io61_async(f)
+//    Put `f` in asynchronous mode: a helper thread reads the next block of
+//    an input while the caller consumes the current one, and writes out
+//    full buffers of an output while the caller fills the next one. A
+//    mapped file is unmapped, so the helper can read ahead into its slots.
+//    Read-write files and files using the block cache are refused.
+//    Returns 0 on success, -1 if not.
+
+int io61_async(io61_file* f) {
+    if (f->async){
+        return 0;
     }
-    //Fill the cache to fullfill the read:
-    io61_fill(f);
-    if (f->cur_tag<f->end_tag){
-        unsigned char buf=f->cach[f->cur_tag-f->start_tag];
-        f->cur_tag++;
-        return buf;
+    if (f->cz || f->peer || f->nonblock || f->shared || f->mode==O_RDWR){
+        return -1;
+    }
+    if (f->mapped){
+        io61_unmap(f);
+        io61_alloc_slots(f);
+    }
+    io61_async_state* a=new io61_async_state;
+    //The helper's writes bypass io61_writev_all:
+    f->sparse=false;
+    if (!f->seekable){
+        a->spare=io61_alloc(f->cach_size);
+    }
+    f->async=a;
+    a->thread=std::thread(io61_async_main,a,f->fd);
+    return 0;
+}
+
+
+// io61_setbuf(f, sz)
+//    Change the cache size of `f` to `sz` bytes (rounded up to a multiple
+//    of 4096, at most 64 MiB). Pending writes are flushed and cached reads
+//    are dropped. A mapped file is unmapped and read through caches of
+//    this size from then on. Fails on files in asynchronous or compressed
+//    mode and on unseekable inputs with unread buffered bytes. Files using
+//    the block cache have no cache of their own, so this does nothing to
+//    them. Returns 0 on success and -1 on failure.
+
+int io61_setbuf(io61_file* f, size_t sz) {
+    if (f->shared){
+        return 0;
+    }
+    if (f->async || f->cz){
+        return -1;
+    }
+    if (f->mode==O_RDONLY && !f->seekable && f->cur_tag<f->end_tag){
+        return -1;
+    }
+    io61_account(f);
+    if (io61_flush(f)<0){
+        return -1;
+    }
+    io61_free_slots(f);
+    f->cach_size=io61_round_size(sz);
+    if (f->mapped){
+        io61_unmap(f);
+    }
+    f->cach=nullptr;
+    f->start_tag=f->end_tag=f->wend_tag=f->run_tag=f->cur_tag;
+    f->last_block=f->stride=0;
+    io61_alloc_slots(f);
+    return 0;
+}
+
+
+// io61_get32(p), io61_get64(p), io61_put32(p, x), io61_put64(p, x)
+//    Little-endian integers of compressed frames.
+
+static uint32_t io61_get32(const unsigned char* p) {
+    return p[0] | p[1]<<8 | p[2]<<16 | (uint32_t)p[3]<<24;
+}
+
+static uint64_t io61_get64(const unsigned char* p) {
+    return io61_get32(p) | (uint64_t)io61_get32(p+4)<<32;
+}
+
+static void io61_put32(unsigned char* p, uint32_t x) {
+    for (int i=0; i<4; i++){
+        p[i]=x>>(8*i);
+    }
+}
+
+static void io61_put64(unsigned char* p, uint64_t x) {
+    io61_put32(p,x);
+    io61_put32(p+4,x>>32);
+}
+
+// io61_lz_sequence(op, oend, lit, nlit, offset, mlen)
+//    Append one LZ4 sequence at `op`: `nlit` literals from `lit`, then a
+//    match of `mlen` bytes `offset` bytes back (no match if `mlen` is 0,
+//    which ends a block). Returns false if it would pass `oend`.
+
+static bool io61_lz_sequence(unsigned char*& op, unsigned char* oend,
+                             const unsigned char* lit, size_t nlit,
+                             size_t offset, size_t mlen) {
+    if ((size_t)(oend-op)<1+nlit/255+1+nlit+2+mlen/255+1){
+        return false;
+    }
+    size_t ml=(mlen ? mlen-4 : 0);
+    unsigned char* token=op++;
+    *token=std::min(nlit,(size_t)15)<<4 | std::min(ml,(size_t)15);
+    if (nlit>=15){
+        size_t k=nlit-15;
+        for (; k>=255; k-=255){
+            *op++=255;
+        }
+        *op++=k;
+    }
+    memcpy(op,lit,nlit);
+    op+=nlit;
+    if (mlen){
+        *op++=offset;
+        *op++=offset>>8;
+        if (ml>=15){
+            size_t k=ml-15;
+            for (; k>=255; k-=255){
+                *op++=255;
+            }
+            *op++=k;
+        }
+    }
+    return true;
+}
+
+// io61_lz_compress(src, n, dst, cap)
+//    Compress the `n` bytes at `src` into at most `cap` bytes at `dst`, in
+//    the LZ4 block format: greedy matching through a hash table of 4-byte
+//    sequences. Returns the compressed size, or 0 if it does not fit.
+
+static size_t io61_lz_compress(const char* src_, size_t n, char* dst_, size_t cap) {
+    const unsigned char* src=(const unsigned char*)src_;
+    const unsigned char* end=src+n;
+    const unsigned char* ip=src;
+    const unsigned char* anchor=src;   //first byte not yet emitted
+    unsigned char* op=(unsigned char*)dst_;
+    unsigned char* oend=op+cap;
+    uint32_t table[1<<12];
+    memset(table,0,sizeof(table));
+    if (n>=13){
+        //LZ4 wants the last 5 bytes to be literals and no match to start
+        //in the last 12:
+        const unsigned char* mflimit=end-12;
+        const unsigned char* matchlimit=end-5;
+        while (ip<mflimit){
+            uint32_t seq, old;
+            memcpy(&seq,ip,4);
+            uint32_t h=(seq*2654435761U)>>20;
+            const unsigned char* ref=src+table[h];
+            table[h]=ip-src;
+            if (ref>=ip || ip-ref>65535 || (memcpy(&old,ref,4), old!=seq)){
+                ip++;
+                continue;
+            }
+            const unsigned char* m=ip+4;
+            const unsigned char* r=ref+4;
+            while (m<matchlimit && *m==*r){
+                m++;
+                r++;
+            }
+            while (ip>anchor && ref>src && ip[-1]==ref[-1]){
+                ip--;
+                ref--;
+            }
+            if (!io61_lz_sequence(op,oend,anchor,ip-anchor,ip-ref,m-ip)){
+                return 0;
+            }
+            ip=anchor=m;
+        }
+    }
+    if (!io61_lz_sequence(op,oend,anchor,end-anchor,0,0)){
+        return 0;
+    }
+    return op-(unsigned char*)dst_;
+}
+
+// io61_lz_decompress(src, n, dst, cap)
+//    Decompress the LZ4 block of `n` bytes at `src` into at most `cap`
+//    bytes at `dst`. Returns the decompressed size, or -1 if the block is
+//    corrupt.
+
+static ssize_t io61_lz_decompress(const char* src, size_t n, char* dst, size_t cap) {
+    const unsigned char* ip=(const unsigned char*)src;
+    const unsigned char* iend=ip+n;
+    char* op=dst;
+    char* oend=dst+cap;
+    while (ip<iend){
+        unsigned token=*ip++;
+        size_t nlit=token>>4;
+        if (nlit==15){
+            unsigned b;
+            do {
+                if (ip>=iend){
+                    return -1;
+                }
+                b=*ip++;
+                nlit+=b;
+            } while (b==255);
+        }
+        if (nlit>(size_t)(iend-ip) || nlit>(size_t)(oend-op)){
+            return -1;
+        }
+        memcpy(op,ip,nlit);
+        ip+=nlit;
+        op+=nlit;
+        if (ip==iend){
+            break;
+        }
+        if (iend-ip<2){
+            return -1;
+        }
+        size_t offset=ip[0] | ip[1]<<8;
+        ip+=2;
+        size_t mlen=token&15;
+        if (mlen==15){
+            unsigned b;
+            do {
+                if (ip>=iend){
+                    return -1;
+                }
+                b=*ip++;
+                mlen+=b;
+            } while (b==255);
+        }
+        mlen+=4;
+        if (offset==0 || offset>(size_t)(op-dst) || mlen>(size_t)(oend-op)){
+            return -1;
+        }
+        const char* ref=op-offset;
+        if (offset>=mlen){
+            memcpy(op,ref,mlen);
+            op+=mlen;
+        }
+        else{
+            //The match overlaps what it produces:
+            for (size_t i=0; i<mlen; i++){
+                *op++=*ref++;
+            }
+        }
+    }
+    return op-dst;
+}
+
+// io61_cz_write_block(f)
+//    Compress the bytes written to the current block of compressed output
+//    `f`, append them to the frame, and start the next block. A block that
+//    does not shrink is stored as is. Returns 0 on success, -1 on error.
+
+static int io61_cz_write_block(io61_file* f) {
+    io61_cz* z=f->cz;
+    size_t n=f->cur_tag-f->start_tag;
+    int r=0;
+    if (n>0){
+        unsigned char hdr[8];
+        size_t c=io61_lz_compress(f->cach,n,z->cbuf,n-1);
+        const char* data=z->cbuf;
+        io61_put32(hdr,c);
+        if (c==0){
+            data=f->cach;
+            c=n;
+            io61_put32(hdr,c|0x80000000U);
+        }
+        io61_put32(hdr+4,n);
+        z->index.push_back({z->coff,f->start_tag});
+        if (io61_write(z->inner,(const char*)hdr,8)!=8
+            || io61_write(z->inner,data,c)!=(ssize_t)c){
+            r=-1;
+        }
+        z->coff+=8+c;
+    }
+    f->start_tag=f->run_tag=f->cur_tag;
+    f->wend_tag=f->start_tag+z->block_size;
+    return r;
+}
+
+// io61_cz_read_index(f)
+//    Load the block index of seekable compressed input `f`. Returns false
+//    if the frame has no valid index (it may have been cut short).
+
+static bool io61_cz_read_index(io61_file* f) {
+    io61_cz* z=f->cz;
+    off_t end=io61_filesize(z->inner)-z->base;
+    unsigned char t[cz_trailer];
+    if (end<8+8+cz_trailer || io61_seek(z->inner,z->base+end-cz_trailer)<0
+        || io61_read(z->inner,(char*)t,cz_trailer)!=cz_trailer
+        || io61_get32(t+24)!=cz_tmagic){
+        return false;
+    }
+    uint64_t n=io61_get64(t);
+    uint64_t ioff=io61_get64(t+8);
+    off_t size=io61_get64(t+16);
+    if (n>(uint64_t)end/16 || ioff!=end-cz_trailer-16*n || size<0){
+        return false;
+    }
+    std::vector<unsigned char> buf(16*n);
+    if (io61_seek(z->inner,z->base+ioff)<0
+        || io61_read(z->inner,(char*)buf.data(),buf.size())!=(ssize_t)buf.size()){
+        return false;
+    }
+    z->index.clear();
+    for (uint64_t i=0; i<n; i++){
+        off_t coff=io61_get64(&buf[16*i]);
+        off_t uoff=io61_get64(&buf[16*i+8]);
+        off_t prev_coff=(i ? z->index.back().first : 0);
+        off_t prev_uoff=(i ? z->index.back().second : -1);
+        if (coff<8 || coff<prev_coff || uoff<=prev_uoff || uoff>=size
+            || (i==0 && uoff!=0)){
+            z->index.clear();
+            return false;
+        }
+        z->index.push_back({coff,uoff});
+    }
+    if (size>0 && n==0){
+        return false;
+    }
+    z->size=size;
+    return true;
+}
+
+// io61_cz_fill(f)
+//    Decompress the block of compressed input `f` holding `f->cur_tag`
+//    into its cache. Inputs with an index may be anywhere; others read
+//    their blocks in order. Returns the number of bytes available after
+//    `f->cur_tag`, 0 at end-of-file, or -1 on error.
+
+static ssize_t io61_cz_fill(io61_file* f) {
+    io61_cz* z=f->cz;
+    if (z->bad){
+        errno=EINVAL;
+        return -1;
+    }
+    if (z->size>=0){
+        if (f->cur_tag>=z->size){
+            return 0;
+        }
+        auto it=std::upper_bound(z->index.begin(),z->index.end(),f->cur_tag,
+                                 [](off_t pos, const std::pair<off_t, off_t>& e) {
+                                     return pos<e.second;
+                                 });
+        --it;
+        if (it->first!=z->coff && io61_seek(z->inner,z->base+it->first)<0){
+            return -1;
+        }
+        z->coff=it->first;
+        f->start_tag=f->end_tag=it->second;
+    }
+    else if (z->eof){
+        return 0;
+    }
+    else{
+        f->start_tag=f->end_tag;
+    }
+    f->stats.refills++;
+    unsigned char hdr[8];
+    ssize_t r=io61_read(z->inner,(char*)hdr,8);
+    if (r<0){
+        return -1;
+    }
+    uint32_t c=io61_get32(hdr)&0x7FFFFFFFU;
+    bool stored=io61_get32(hdr)>>31;
+    uint32_t n=io61_get32(hdr+4);
+    if (r==8 && c==0 && n==0 && !stored){
+        z->eof=true;
+        return 0;
+    }
+    if (r!=8 || n==0 || n>z->block_size || c>z->block_size || (stored && c!=n)){
+        z->bad=true;
+        errno=EINVAL;
+        return -1;
+    }
+    //Decompress straight out of the inner cache (or mapping) if the
+    //block is all there:
+    const char* data;
+    size_t avail;
+    bool peeked=io61_peek(z->inner,&data,&avail)==0 && avail>=c;
+    if (!peeked){
+        if (io61_read(z->inner,z->cbuf,c)!=(ssize_t)c){
+            z->bad=true;
+            errno=EINVAL;
+            return -1;
+        }
+        data=z->cbuf;
+    }
+    ssize_t got=n;
+    if (stored){
+        memcpy(f->cach,data,n);
+    }
+    else{
+        got=io61_lz_decompress(data,c,f->cach,n);
+    }
+    if (peeked){
+        io61_consume(z->inner,c);
+    }
+    if (got!=(ssize_t)n){
+        z->bad=true;
+        errno=EINVAL;
+        return -1;
+    }
+    z->coff+=8+c;
+    f->end_tag=f->start_tag+n;
+    if (f->cur_tag<f->start_tag || f->cur_tag>=f->end_tag){
+        //The index does not match the blocks:
+        z->bad=true;
+        errno=EINVAL;
+        return -1;
+    }
+    return f->end_tag-f->cur_tag;
+}
+
+// io61_cz_seek(f, pos)
+//    io61_seek for compressed files. Only inputs with an index can seek.
+
+static int io61_cz_seek(io61_file* f, off_t pos) {
+    if (f->mode!=O_RDONLY || pos<0 || (f->cz->size<0 && pos!=f->cur_tag)){
+        return -1;
+    }
+    f->cur_tag=pos;
+    f->stats.seeks++;
+    return 0;
+}
+
+// io61_cz_close(f)
+//    Finish the frame of compressed output `f` (its last block is already
+//    written by io61_flush), close the inner file, and free the
+//    compression state. Returns 0 on success and -1 on error.
+
+static int io61_cz_close(io61_file* f) {
+    io61_cz* z=f->cz;
+    int r=0;
+    if (f->mode!=O_RDONLY){
+        r=io61_cz_write_block(f);
+        std::vector<unsigned char> tail(8+16*z->index.size()+cz_trailer,0);
+        unsigned char* p=&tail[8];
+        for (auto& e:z->index){
+            io61_put64(p,e.first);
+            io61_put64(p+8,e.second);
+            p+=16;
+        }
+        io61_put64(p,z->index.size());
+        io61_put64(p+8,z->coff+8);
+        io61_put64(p+16,f->cur_tag);
+        io61_put32(p+24,cz_tmagic);
+        if (io61_write(z->inner,(const char*)tail.data(),tail.size())!=(ssize_t)tail.size()){
+            r=-1;
+        }
+    }
+    if (io61_close(z->inner)<0){
+        r=-1;
+    }
+    io61_free(z->cbuf,z->block_size);
+    io61_free(f->cach,f->cach_size);
+    delete z;
+    f->cz=nullptr;
+    f->cach=nullptr;
+    return r;
+}
+
+// io61_compress(f)
+//    Put `f` in compressed mode before anything is read or written: data
+//    written is compressed in blocks of 64 KiB with an LZ4-style codec,
+//    and data read is decompressed from such a frame. Inputs with the
+//    frame's block index (seekable ones) can seek; outputs cannot. Returns
+//    0 on success, or -1 if `f` was already used or is asynchronous, or if
+//    an input does not hold a compressed frame (reads then fail).
+
+int io61_compress(io61_file* f) {
+    if (f->cz){
+        return 0;
+    }
+    io61_account(f);
+    if (f->async || f->peer || f->nonblock || f->mode==O_RDWR
+        || f->stats.nread || f->stats.nwritten || f->stats.seeks){
+        return -1;
+    }
+    //The file as it is becomes the inner file, which owns the descriptor:
+    io61_file* inner=new io61_file(std::move(*f));
+    inner->digest=nullptr;  //the outer file sums the uncompressed bytes
+    f->pcache=nullptr;
+    f->mapped=false;
+    f->shared=false;
+    f->pinned=nullptr;
+    f->nslots=0;
+    f->wcur=nullptr;
+    f->wlru.clear();
+    f->wslots.clear();
+    f->wfree.clear();
+    f->line.clear();
+    f->stats=io61_stats();
+    f->cur_tag=f->start_tag=f->end_tag=f->wend_tag=f->run_tag=f->fd_tag=f->sum_tag=0;
+    f->last_block=f->stride=0;
+
+    io61_cz* z=new io61_cz;
+    z->inner=inner;
+    z->base=inner->cur_tag;
+    z->block_size=cz_block;
+    z->size=-1;
+    z->coff=8;
+    z->eof=z->bad=false;
+    f->cz=z;
+    int r=0;
+    unsigned char hdr[8];
+    if (f->mode!=O_RDONLY){
+        io61_put32(hdr,cz_magic);
+        io61_put32(hdr+4,z->block_size);
+        r=(io61_write(inner,(const char*)hdr,8)==8 ? 0 : -1);
+    }
+    else if (io61_read(inner,(char*)hdr,8)!=8 || io61_get32(hdr)!=cz_magic
+             || io61_get32(hdr+4)==0 || io61_get32(hdr+4)>cach_max){
+        z->bad=true;
+        r=-1;
+    }
+    else{
+        z->block_size=io61_get32(hdr+4);
+        if (inner->seekable && !io61_cz_read_index(f)){
+            z->size=-1;
+            z->index.clear();
+        }
+        if (inner->seekable && io61_seek(inner,z->base+8)<0){
+            z->bad=true;
+            r=-1;
+        }
+    }
+    f->cach_size=z->block_size;
+    f->cach=io61_alloc(f->cach_size);
+    z->cbuf=io61_alloc(z->block_size);
+    return r;
+}
+
+
+// io61_now()
+//    Return a monotonic time in nanoseconds.
+
+static long long io61_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+// io61_duplex_wrote(f)
+//    Called after writes to duplex output `f`: write out its buffer if the
+//    oldest buffered byte has waited out its latency budget.
+
+static void io61_duplex_wrote(io61_file* f) {
+    if (f->latency<0 || f->cur_tag==f->start_tag){
+        return;
+    }
+    //Latency 0 writes through without looking at the clock:
+    long long now=(f->latency==0 ? 0 : io61_now());
+    if (f->pending_since==0){
+        f->pending_since=now;
+    }
+    if (now-f->pending_since>=f->latency*1000LL){
+        io61_flush(f);
+    }
+}
+
+// io61_duplex_read(f)
+//    Called before duplex input `f` reads its descriptor: if the read
+//    might block and the paired output has buffered bytes, write them out
+//    first, since the other side may be waiting for them. Returns 0, or
+//    -1 if that write failed.
+
+static int io61_duplex_read(io61_file* f) {
+    io61_file* w=f->peer;
+    if (!w || w->cur_tag==w->start_tag){
+        return 0;
+    }
+    struct pollfd p={f->fd,POLLIN,0};
+    f->stats.syscalls++;
+    if (poll(&p,1,0)==1){
+        return 0;
+    }
+    return io61_flush(w);
+}
+
+// io61_duplex(inf, outf, latency)
+//    Pair input `inf` with output `outf`, both pipes or sockets, for
+//    request/response traffic. Whenever a read from `inf` could block,
+//    bytes buffered in `outf` are written first, so io61_flush is never
+//    needed to get a reply. `latency` bounds how long small writes are
+//    coalesced: -1 holds them until `outf`'s buffer fills or `inf` needs
+//    data; 0 writes each io61_write and io61_writec through at once; a
+//    positive value writes out bytes that have waited that many
+//    microseconds (checked at each write, so a program that stops
+//    writing without reading should flush). Returns 0 on success and -1
+//    if the files are not unseekable input and output or are in
+//    asynchronous or compressed mode.
+
+int io61_duplex(io61_file* inf, io61_file* outf, long latency) {
+    if (inf->mode!=O_RDONLY || outf->mode==O_RDONLY || inf->seekable
+        || outf->seekable || inf->async || outf->async || inf->cz || outf->cz){
+        return -1;
+    }
+    if (inf->peer){
+        inf->peer->peer=nullptr;
+    }
+    if (outf->peer){
+        outf->peer->peer=nullptr;
+    }
+    inf->peer=outf;
+    outf->peer=inf;
+    outf->latency=latency;
+    outf->pending_since=0;
+    return 0;
+}
+
+
+// io61_nonblock(f)
+//    Put unseekable file `f` (a pipe, socket or terminal) in nonblocking
+//    mode. Reads return what is buffered or available now, and -1 with
+//    `errno` EAGAIN if nothing is; writes take what fits in the buffer
+//    after writing out as much as the descriptor takes now, and return
+//    -1 with `errno` EAGAIN if nothing fits. io61_readc and io61_writec
+//    fail with EAGAIN the same way, and io61_flush fails with EAGAIN while
+//    bytes remain buffered. io61_close waits until the buffer is written.
+//    Use an io61_poller to wait for files to become ready. O_NONBLOCK is
+//    shared by every descriptor for the same open file, including ones in
+//    other processes. Returns 0 on success, or -1 if `f` is seekable or
+//    in asynchronous or compressed mode.
+
+int io61_nonblock(io61_file* f) {
+    if (f->nonblock){
+        return 0;
+    }
+    if (f->seekable || f->async || f->cz){
+        errno=EINVAL;
+        return -1;
+    }
+    f->stats.syscalls++;
+    int flags=fcntl(f->fd,F_GETFL);
+    if (flags<0 || (!(flags&O_NONBLOCK)
+                    && (f->stats.syscalls++,fcntl(f->fd,F_SETFL,flags|O_NONBLOCK))<0)){
+        return -1;
+    }
+    f->nonblock=true;
+    return 0;
+}
+
+
+// io61_crc32c(crc, p, n)
+//    Return the running CRC32C `crc` (not yet inverted) extended by the
+//    `n` bytes at `p`. x86-64 machines with SSE4.2, and ARM machines with
+//    the CRC extension, use the crc32 instructions (8 bytes per
+//    instruction); others look up a table 8 bytes at a time.
+
+static uint32_t io61_crc_table[8][256];
+
+static void io61_crc_init() {
+    for (uint32_t i=0; i<256; i++){
+        uint32_t c=i;
+        for (int k=0; k<8; k++){
+            c=(c>>1)^(c&1 ? 0x82F63B78 : 0);
+        }
+        io61_crc_table[0][i]=c;
+    }
+    for (uint32_t i=0; i<256; i++){
+        for (int t=1; t<8; t++){
+            uint32_t c=io61_crc_table[t-1][i];
+            io61_crc_table[t][i]=(c>>8)^io61_crc_table[0][c&0xFF];
+        }
+    }
+}
+
+static uint32_t io61_crc32c_sw(uint32_t crc, const unsigned char* p, size_t n) {
+    static std::once_flag once;
+    std::call_once(once,io61_crc_init);
+    const uint32_t (*t)[256]=io61_crc_table;
+    while (n>=8){
+        uint32_t lo=io61_get32(p)^crc, hi=io61_get32(p+4);
+        crc=t[7][lo&0xFF]^t[6][(lo>>8)&0xFF]^t[5][(lo>>16)&0xFF]^t[4][lo>>24]
+            ^t[3][hi&0xFF]^t[2][(hi>>8)&0xFF]^t[1][(hi>>16)&0xFF]^t[0][hi>>24];
+        p+=8;
+        n-=8;
+    }
+    while (n--){
+        crc=(crc>>8)^t[0][(crc^*p++)&0xFF];
+    }
+    return crc;
+}
+
+#if __x86_64__
+__attribute__((target("sse4.2")))
+static uint32_t io61_crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+    uint64_t c=crc;
+    while (n>=8){
+        uint64_t x;
+        memcpy(&x,p,8);
+        c=_mm_crc32_u64(c,x);
+        p+=8;
+        n-=8;
+    }
+    while (n--){
+        c=_mm_crc32_u8(c,*p++);
+    }
+    return c;
+}
+#elif __aarch64__ && __ARM_FEATURE_CRC32
+static uint32_t io61_crc32c_hw(uint32_t crc, const unsigned char* p, size_t n) {
+    while (n>=8){
+        uint64_t x;
+        memcpy(&x,p,8);
+        crc=__crc32cd(crc,x);
+        p+=8;
+        n-=8;
+    }
+    while (n--){
+        crc=__crc32cb(crc,*p++);
+    }
+    return crc;
+}
+#endif
+
+static uint32_t io61_crc32c(uint32_t crc, const char* p, size_t n) {
+#if __x86_64__
+    static const bool hw=__builtin_cpu_supports("sse4.2");
+    if (hw){
+        return io61_crc32c_hw(crc,(const unsigned char*)p,n);
+    }
+#elif __aarch64__ && __ARM_FEATURE_CRC32
+    return io61_crc32c_hw(crc,(const unsigned char*)p,n);
+#endif
+    return io61_crc32c_sw(crc,(const unsigned char*)p,n);
+}
+
+// io61_sum(f, p, n), io61_sumv(f, iov, iovcnt, n)
+//    In checksum mode, add the `n` bytes at `p` (the first `n` bytes of
+//    the buffers `iov`) to the checksum of `f`. These are for bytes that
+//    bypass the cache; io61_account sums the cached ones.
+
+static inline void io61_sum(io61_file* f, const char* p, size_t n) {
+    if (f->digest){
+        f->crc=io61_crc32c(f->crc,p,n);
+    }
+}
+
+static void io61_sumv(io61_file* f, const struct iovec* iov, int iovcnt, size_t n) {
+    for (int i=0; i<iovcnt && n>0 && f->digest; i++){
+        size_t k=std::min(n,iov[i].iov_len);
+        io61_sum(f,(const char*)iov[i].iov_base,k);
+        n-=k;
+    }
+}
+
+// io61_checksum(f, digest)
+//    Start computing the CRC32C (Castagnoli) checksum of the bytes read
+//    from or written to `f` from now on, in the order the program reads
+//    or writes them (io61_pread and io61_pwrite are not counted).
+//    io61_close stores the final digest, the value `crc32c` tools print,
+//    in `*digest`. A null `digest` stops checksumming. Returns 0 on
+//    success, or -1 if `f` is read-write.
+
+int io61_checksum(io61_file* f, uint32_t* digest) {
+    if (f->mode==O_RDWR){
+        errno=EINVAL;
+        return -1;
+    }
+    //Bytes moved before now are not summed:
+    io61_account(f);
+    f->digest=digest;
+    f->crc=0xFFFFFFFF;
+    return 0;
+}
+
+
+static int io61_unreserve(io61_file* f);
+
+// io61_sync_offset(f)
+//    Move the descriptor's offset to `f->cur_tag`. Seekable files read
+//    and write at explicit offsets, which leave the descriptor's offset
+//    where it was, so this puts it right whenever someone else sharing the
+//    descriptor may look: after a flush and at close. (A shell running
+//    `./cat61 a; ./cat61 b` with one stdout needs the second program to
+//    start where the first stopped.) Returns 0 on success and -1 on error.
+
+static int io61_sync_offset(io61_file* f) {
+    if (!f->seekable || f->cz || f->fd_tag==f->cur_tag){
+        return 0;
+    }
+    io61_count(f->stats.syscalls,1);
+    if (lseek(f->fd,f->cur_tag,SEEK_SET)<0){
+        return -1;
+    }
+    f->fd_tag=f->cur_tag;
+    return 0;
+}
+
+
+// io61_close(f)
+//    Close the io61_file `f` and release all its resources.
+
+int io61_close(io61_file* f) {
+    //Nonblocking outputs wait for the descriptor to take their buffer:
+    while (io61_flush(f)<0 && f->nonblock && errno==EAGAIN){
+        struct pollfd p={f->fd,POLLOUT,0};
+        f->stats.syscalls++;
+        poll(&p,1,-1);
+    }
+    if (f->peer){
+        f->peer->peer=nullptr;
+    }
+    if (f->async){
+        io61_async_stop(f);
+    }
+    io61_account(f);
+    //Leave a shared input descriptor just past what we read (outputs did
+    //this in io61_flush):
+    if (f->mode==O_RDONLY){
+        io61_sync_offset(f);
+    }
+    {
+        std::lock_guard<std::mutex> guard(io61_totals_mutex);
+        io61_totals.syscalls+=f->stats.syscalls;
+        io61_totals.nread+=f->stats.nread;
+        io61_totals.nwritten+=f->stats.nwritten;
+        io61_totals.hits+=f->stats.hits;
+        io61_totals.misses+=f->stats.misses;
+        io61_totals.seeks+=f->stats.seeks;
+        io61_totals.flushes+=f->stats.flushes;
+        io61_totals.refills+=f->stats.refills;
+    }
+    if (f->digest){
+        *f->digest=~f->crc;
+    }
+    int r=0;
+    if (f->prealloc>0 && !f->cz && io61_unreserve(f)<0){
+        r=-1;
+    }
+    if (f->cz){
+        //The inner file owns the descriptor:
+        r=io61_cz_close(f);
+    }
+    else if (close(f->fd)<0){
+        r=-1;
+    }
+    if (f->mapped){
+        munmap(f->cach,f->end_tag);
+    }
+    io61_bcache_unpin(f);
+    io61_free_slots(f);
+    if (f->pcache){
+        for (auto& b:f->pcache->blocks){
+            io61_free(b.second.data,f->pcache->block_size);
+        }
+        delete f->pcache;
+    }
+    delete f;
+    return r;
+}
+
+// io61_find_slot(f, pos)
+//    Return the slot of `f` holding the byte at `pos`, or nullptr.
+
+static io61_slot* io61_find_slot(io61_file* f, off_t pos) {
+    for (int i=0; i<f->nslots; i++){
+        if (f->slots[i].tag<=pos && pos<f->slots[i].end){
+            return &f->slots[i];
+        }
+    }
+    return nullptr;
+}
+
+// io61_fill_slots(f, block)
+//    Read `block` of seekable file `f` into the least recently used slot.
+//    When the misses so far walk forwards or backwards one block at a
+//    time, the next blocks in that direction are read too, by the same
+//    preadv, into the next least recently used slots. When they walk with
+//    a longer stride, the kernel is asked to prefetch the next block.
+//    Returns the slot holding `block`, or nullptr on error.
+
+static io61_slot* io61_fill_slots(io61_file* f, off_t block) {
+    off_t delta=block-f->last_block;
+    bool predicted=delta!=0 && delta==f->stride;
+    f->stride=delta;
+    f->last_block=block;
+
+    //How many blocks to read, stopping at any block we already have:
+    int n=1;
+    if (predicted && (delta==1 || delta==-1)){
+        while (n<cach_slots/2 && block+n*delta>=0
+               && !io61_find_slot(f,(block+n*delta)*f->cach_size)){
+            n++;
+        }
+    }
+    //Pick the n least recently used slots; victims[i] gets block+i*delta:
+    io61_slot* victims[cach_slots];
+    for (int i=0; i<n; i++){
+        io61_slot* lru=&f->slots[0];
+        for (int j=1; j<f->nslots; j++){
+            if (f->slots[j].used<lru->used) lru=&f->slots[j];
+        }
+        lru->used=++f->clock;
+        victims[i]=lru;
+    }
+    //preadv wants the buffers in file order:
+    struct iovec iov[cach_slots];
+    off_t first=(delta<0 ? block-(n-1) : block);
+    for (int i=0; i<n; i++){
+        io61_slot* v=victims[delta<0 ? n-1-i : i];
+        v->tag=v->end=(first+i)*f->cach_size;
+        iov[i].iov_base=v->data;
+        iov[i].iov_len=f->cach_size;
+    }
+    ssize_t r;
+    do {
+        f->stats.syscalls++;
+        r=preadv(f->fd,iov,n,first*f->cach_size);
+    } while (r<0 && errno==EINTR);
+    if (r<0){
+        return nullptr;
+    }
+    //The next miss continues from the far end of what we read:
+    f->last_block=block+(n-1)*delta;
+    for (int i=0; i<n; i++){
+        io61_slot* v=victims[delta<0 ? n-1-i : i];
+        off_t got=std::min((off_t)f->cach_size,std::max((off_t)0,(off_t)r-i*f->cach_size));
+        v->end=v->tag+got;
+    }
+#ifdef POSIX_FADV_WILLNEED
+    if (predicted && n==1 && block+delta>=0){
+        f->stats.syscalls++;
+        posix_fadvise(f->fd,(block+delta)*f->cach_size,f->cach_size,POSIX_FADV_WILLNEED);
+    }
+#endif
+    return victims[0];
+}
+
+// io61_async_ahead(f, slot)
+//    Start the helper of seekable input `f` reading the block after
+//    `slot` into the least recently used other slot, unless that block is
+//    cached already, the file ends in `slot`, or a read-ahead is running.
+//    Until it is collected the slot matches no position and is never
+//    picked for a refill.
+
+static void io61_async_ahead(io61_file* f, io61_slot* slot) {
+    io61_async_state* a=f->async;
+    off_t next=slot->tag+f->cach_size;
+    if (a->running || slot->end<next || io61_find_slot(f,next)){
+        return;
+    }
+    io61_slot* lru=nullptr;
+    for (int j=0; j<f->nslots; j++){
+        if (&f->slots[j]!=slot && (!lru || f->slots[j].used<lru->used)) lru=&f->slots[j];
+    }
+    lru->tag=lru->end=0;
+    lru->used=ULLONG_MAX;
+    a->rslot=lru;
+    io61_async_submit(f,false,lru->data,f->cach_size,next);
+}
+
+// io61_async_take(f)
+//    Collect the helper's read-ahead of seekable input `f`, if any, into
+//    its slot. Returns the slot if it holds `f->cur_tag`, nullptr if not.
+
+static io61_slot* io61_async_take(io61_file* f) {
+    io61_async_state* a=f->async;
+    io61_slot* slot=a->rslot;
+    if (!slot){
+        return nullptr;
+    }
+    off_t pos=a->pos;
+    ssize_t r=io61_async_collect(f);
+    a->rslot=nullptr;
+    f->stats.refills++;
+    slot->used=f->clock;
+    slot->tag=pos;
+    slot->end=pos+std::max(r,(ssize_t)0);
+    return slot->tag<=f->cur_tag && f->cur_tag<slot->end ? slot : nullptr;
+}
+
+// Read-write files read through their write slots; see below.
+static ssize_t io61_rw_fill(io61_file* f);
+
+// io61_fill(f)
+//    Refill the cache of readable file `f` with the data at `f->cur_tag`.
+//    Returns the number of bytes available after `f->cur_tag`, 0 at
+//    end-of-file, or -1 on error.
+
+ssize_t io61_fill(io61_file* f){
+    io61_account(f);
+    if (f->cz){
+        return io61_cz_fill(f);
+    }
+    //A mapping already holds the whole file:
+    if (f->mapped){
+        return f->cur_tag<f->end_tag ? f->end_tag-f->cur_tag : 0;
+    }
+    if (f->shared){
+        return io61_bcache_fill(f);
+    }
+    if (f->mode==O_RDWR){
+        return io61_rw_fill(f);
+    }
+    if (f->seekable){
+        //Use a slot we already have if we can, otherwise read one:
+        io61_slot* slot=io61_find_slot(f,f->cur_tag);
+        if (!slot && f->async){
+            slot=io61_async_take(f);
+        }
+        if (!slot){
+            f->stats.refills++;
+            slot=io61_fill_slots(f,f->cur_tag/f->cach_size);
+        }
+        if (!slot){
+            f->start_tag=f->end_tag=f->cur_tag;
+            return -1;
+        }
+        slot->used=++f->clock;
+        f->cach=slot->data;
+        f->start_tag=slot->tag;
+        f->end_tag=slot->end;
+        //Start reading the next block while the caller works:
+        if (f->async){
+            io61_async_ahead(f,slot);
+        }
+        return f->cur_tag<f->end_tag ? f->end_tag-f->cur_tag : 0;
+    }
+    //We can't seek, so the data simply starts where we are:
+    f->start_tag=f->end_tag=f->cur_tag;
+    f->stats.refills++;
+    ssize_t sz;
+    if (f->async && f->async->running){
+        //The helper already read the next block into the spare buffer:
+        sz=io61_async_collect(f);
+        std::swap(f->cach,f->async->spare);
+        f->slots[0].data=f->cach;
+    }
+    else{
+        if (io61_duplex_read(f)<0){
+            return -1;
+        }
+        do {
+            f->stats.syscalls++;
+            sz=read(f->fd,f->cach,f->cach_size);
+        } while (sz<0 && errno==EINTR);
+    }
+    if (sz>0){
+        f->end_tag+=sz;
+        f->fd_tag=f->end_tag;
+        //Start reading the block after this one while the caller works:
+        if (f->async){
+            io61_async_submit(f,false,f->async->spare,f->cach_size,-1);
+        }
+        return sz;
+    }
+    return sz<0 ? -1 : 0;
+}
+
+// io61_readc(f)
+//    Read a single (unsigned) character from `f` and return it. Returns EOF
+//    (which is -1) on error or end-of-file.
+
+int io61_readc(io61_file* f) {
+    //Can we fullfill this read without making system calls:
+    if (f->cur_tag<f->end_tag && f->cur_tag>=f->start_tag){
+        unsigned char buf=f->cach[f->cur_tag-f->start_tag];
+        f->cur_tag++;
+        return buf;
+    }
+    //Fill the cache to fullfill the read:
+    f->stats.misses++;
+    if (io61_fill(f)>0){
+        unsigned char buf=f->cach[f->cur_tag-f->start_tag];
+        f->cur_tag++;
+        return buf;
+    }
+    //If nothing was filled then this is the EOF:
+    return EOF;
+}
+
+
+// io61_read(f, buf, sz)
+//    Read up to `sz` characters from `f` into `buf`. Returns the number of
+//    characters read on success; normally this is `sz`. Returns a short
+//    count, which might be zero, if the file ended before `sz` characters
+//    could be read. Returns -1 if an error occurred before any characters
+//    were read.
+
+ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
+    struct iovec iov={buf,sz};
+    return io61_readv(f,&iov,1);
+}
+
+
+// io61_read_direct(f, iov, iovcnt)
+//    Read into the caller's buffers `iov` straight from the file, with the
+//    same readv/preadv also refilling a cache with the bytes that follow
+//    them. The cache must have nothing at `f->cur_tag`. Returns the number
+//    of bytes read into `iov`, 0 at end-of-file, or -1 on error.
+
+static ssize_t io61_read_direct(io61_file* f, const struct iovec* iov, int iovcnt) {
+    io61_account(f);
+    struct iovec v[IOV_MAX];
+    int n=std::min(iovcnt,IOV_MAX-1);
+    size_t total=0;
+    for (int i=0; i<n; i++){
+        v[i]=iov[i];
+        total+=iov[i].iov_len;
+    }
+    //The cache gets the least recently used slot:
+    io61_slot* slot=&f->slots[0];
+    for (int j=1; j<f->nslots; j++){
+        if (f->slots[j].used<slot->used) slot=&f->slots[j];
+    }
+    slot->used=++f->clock;
+    slot->tag=slot->end=0;
+    v[n].iov_base=slot->data;
+    v[n].iov_len=f->cach_size;
+    if (io61_duplex_read(f)<0){
+        return -1;
+    }
+    ssize_t r;
+    do {
+        f->stats.syscalls++;
+        r=(f->seekable ? preadv(f->fd,v,n+1,f->cur_tag) : readv(f->fd,v,n+1));
+    } while (r<0 && errno==EINTR);
+    if (r<0){
+        return -1;
+    }
+    size_t user=std::min((size_t)r,total);
+    f->cur_tag+=user;
+    f->sum_tag=f->cur_tag;
+    if (!f->seekable){
+        f->fd_tag+=r;
+    }
+    //Whatever landed past the caller's buffers is now our cache:
+    slot->tag=f->cur_tag;
+    slot->end=f->cur_tag+(r-user);
+    f->cach=slot->data;
+    f->start_tag=slot->tag;
+    f->end_tag=slot->end;
+    return user;
+}
+
+
+// io61_readv(f, iov, iovcnt)
+//    Read into the `iovcnt` buffers `iov` in order, like io61_read.
+//    Large reads go straight to the caller's buffers with one readv that
+//    also refills the cache.
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t total=0;
+    for (int i=0; i<iovcnt; i++){
+        total+=iov[i].iov_len;
+    }
+    size_t nread=0;
+    int i=0;
+    size_t off=0;   //bytes already read into iov[i]
+    bool missed=false;
+    ssize_t r=0;
+    while (i<iovcnt){
+        if (off==iov[i].iov_len){
+            i++;
+            off=0;
+            continue;
+        }
+        char* dst=(char*)iov[i].iov_base+off;
+        size_t want=iov[i].iov_len-off;
+        //Take whatever the cache has at our position:
+        if (f->cur_tag<f->end_tag && f->cur_tag>=f->start_tag){
+            size_t n=std::min((size_t)(f->end_tag-f->cur_tag),want);
+            memcpy(dst,&f->cach[f->cur_tag-f->start_tag],n);
+            f->cur_tag+=n;
+            off+=n;
+            nread+=n;
+            continue;
+        }
+        missed=true;
+        if (f->mode==O_RDONLY && !f->mapped && !f->shared && !f->async && !f->cz
+            && !f->direct && total-nread>=(size_t)f->cach_size){
+            //If one more fill will still not be enough then it is better
+            //to read directly into the caller's buffers instead of having
+            //a loop of fills:
+            struct iovec rest[IOV_MAX];
+            int n=0;
+            rest[n].iov_base=dst;
+            rest[n++].iov_len=want;
+            for (int j=i+1; j<iovcnt && n<IOV_MAX-1; j++){
+                rest[n++]=iov[j];
+            }
+            r=io61_read_direct(f,rest,n);
+            if (r>0){
+                io61_sumv(f,rest,n,r);
+                f->stats.nread+=r;
+                nread+=r;
+                //Move past the buffers we filled:
+                for (size_t left=r; left>0; ){
+                    size_t k=std::min(left,iov[i].iov_len-off);
+                    off+=k;
+                    left-=k;
+                    if (off==iov[i].iov_len && left>0){
+                        i++;
+                        off=0;
+                    }
+                }
+                continue;
+            }
+        }
+        else{
+            //Do a fill and then get the rest of the bytes that we want:
+            r=io61_fill(f);
+        }
+        if (r<=0){
+            break;
+        }
+    }
+    if (missed){
+        f->stats.misses++;
+    }
+    return nread==0 && r<0 ? -1 : nread;
+}
+
+
+// io61_peek(f, ptr, len)
+//    Make `*ptr` point at the bytes buffered at the current position of
+//    read-only file `f` and set `*len` to how many there are, refilling
+//    the cache if it is empty. Nothing is copied: `*ptr` points into the
+//    cache or the mapping and is valid until the next call on `f`.
+//    Returns 0 on success (`*len == 0` means end-of-file) and -1 on error.
+
+int io61_peek(io61_file* f, const char** ptr, size_t* len) {
+    if (f->cur_tag>=f->end_tag || f->cur_tag<f->start_tag){
+        f->stats.misses++;
+        ssize_t r=io61_fill(f);
+        if (r<=0){
+            *ptr=nullptr;
+            *len=0;
+            return r<0 ? -1 : 0;
+        }
+    }
+    *ptr=&f->cach[f->cur_tag-f->start_tag];
+    *len=f->end_tag-f->cur_tag;
+    return 0;
+}
+
+
+// io61_consume(f, n)
+//    Advance the position of `f` past `n` bytes returned by io61_peek.
+//    `n` must not exceed the `*len` io61_peek reported.
+
+void io61_consume(io61_file* f, size_t n) {
+    assert(f->cur_tag>=f->start_tag && (off_t)n<=f->end_tag-f->cur_tag);
+    f->cur_tag+=n;
+}
+
+
+// io61_readline(f, ptr, len)
+//    Read the next line of read-only file `f`, with its newline (the last
+//    line may lack one). `*ptr` points at the line and `*len` is its
+//    length; both are valid until the next call on `f`. Lines that lie
+//    in the cache (every line of a mapped file) are returned in place;
+//    only lines that span refills are copied. Returns 0 on success
+//    (`*len == 0` means end-of-file) and -1 on error.
+
+int io61_readline(io61_file* f, const char** ptr, size_t* len) {
+    const char* p;
+    size_t n;
+    const char* nl;
+    if (!f->line_more){
+        if (io61_peek(f,&p,&n)<0){
+            return -1;
+        }
+        if (n==0){
+            *ptr=p;
+            *len=0;
+            return 0;
+        }
+        //memchr is vectorized, so this runs at memory speed:
+        nl=(const char*)memchr(p,'\n',n);
+        if (nl){
+            *ptr=p;
+            *len=nl+1-p;
+            io61_consume(f,*len);
+            return 0;
+        }
+        f->line.assign(p,p+n);
+        io61_consume(f,n);
+        f->line_more=true;
+    }
+    //The line continues past the cache; gather it (if a nonblocking read
+    //fails, the next call carries on from here):
+    while (1){
+        if (io61_peek(f,&p,&n)<0){
+            return -1;
+        }
+        if (n==0){
+            break;
+        }
+        nl=(const char*)memchr(p,'\n',n);
+        size_t k=(nl ? nl+1-p : n);
+        f->line.insert(f->line.end(),p,p+k);
+        io61_consume(f,k);
+        if (nl){
+            break;
+        }
+    }
+    f->line_more=false;
+    *ptr=f->line.data();
+    *len=f->line.size();
+    return 0;
+}
+
+
+// io61_end_run(f)
+//    Mark the bytes written to the current write slot since the last seek
+//    dirty in its bitmap. (While a read-write file is reading, its write
+//    window is closed and there is no run.)
+
+static void io61_end_run(io61_file* f) {
+    io61_wslot* ws=f->wcur;
+    if (ws && f->cur_tag>f->run_tag && f->wend_tag>f->start_tag){
+        f->size=std::max(f->size,f->cur_tag);
+        ws->lo=std::min(ws->lo,f->run_tag-ws->tag);
+        ws->hi=std::max(ws->hi,f->cur_tag-ws->tag);
+        for (off_t i=f->run_tag-ws->tag; i<f->cur_tag-ws->tag; ){
+            unsigned long long& word=ws->dirty[i/64];
+            //Set as many bits of this word as the run covers:
+            off_t n=std::min((off_t)64-i%64,f->cur_tag-ws->tag-i);
+            unsigned long long bits=(n==64 ? ~0ULL : ((1ULL<<n)-1)<<(i%64));
+            ws->ndirty+=__builtin_popcountll(bits&~word);
+            word|=bits;
+            i+=n;
+        }
+    }
+    f->run_tag=f->cur_tag;
+}
+
+// io61_wrote(f, pos, n)
+//    Note that `n` bytes at `pos` of seekable file `f` were written to the
+//    file, for its size and (in sparse mode) its written extents. The size
+//    grows atomically, since io61_pwrite calls may run at once; sparse
+//    files take no concurrent io61_pwrite (see io61_sparse).
+
+static void io61_wrote(io61_file* f, off_t pos, size_t n) {
+    off_t end=pos+n;
+    off_t size=__atomic_load_n(&f->size,__ATOMIC_RELAXED);
+    while (size<end && !__atomic_compare_exchange_n(&f->size,&size,end,true,
+                                                    __ATOMIC_RELAXED,__ATOMIC_RELAXED)){
+    }
+    if (!f->sparse || n==0){
+        return;
+    }
+    f->disk_size=std::max(f->disk_size,end);
+    //Merge [pos, end) with the extents it overlaps or touches:
+    auto it=f->written.upper_bound(pos);
+    if (it!=f->written.begin() && std::prev(it)->second>=pos){
+        --it;
+        pos=it->first;
+    }
+    while (it!=f->written.end() && it->first<=end){
+        end=std::max(end,it->second);
+        it=f->written.erase(it);
+    }
+    f->written.emplace(pos,end);
+}
+
+// io61_unwritten(f, pos, n)
+//    Return true if no byte of [pos, pos+n) of sparse output `f` was
+//    written since sparse mode was turned on.
+
+static bool io61_unwritten(io61_file* f, off_t pos, size_t n) {
+    auto it=f->written.upper_bound(pos);
+    if (it!=f->written.begin() && std::prev(it)->second>pos){
+        return false;
+    }
+    return it==f->written.end() || it->first>=pos+(off_t)n;
+}
+
+// io61_writev_all(f, iov, iovcnt, pos)
+//    Write all the bytes of the `iovcnt` buffers `iov` to `f` (at offset
+//    `pos` if `f` is seekable), retrying short writes. Modifies `iov`.
+//    Returns 0 on success and -1 on error.
+
+static int io61_writev_all(io61_file* f, struct iovec* iov, int iovcnt, off_t pos) {
+    while (iovcnt>0){
+        if (iov->iov_len==0){
+            iov++;
+            iovcnt--;
+            continue;
+        }
+        io61_count(f->stats.syscalls,1);
+        ssize_t r=(f->seekable ? pwritev(f->fd,iov,iovcnt,pos) : writev(f->fd,iov,iovcnt));
+        if (r<0 && errno==EINTR){
+            continue;
+        }
+        if (r<=0){
+            return -1;
+        }
+        if (f->seekable){
+            io61_wrote(f,pos,r);
+        }
+        pos+=r;
+        if (!f->seekable){
+            f->fd_tag+=r;
+        }
+        //Skip what was written:
+        while (r>0){
+            size_t k=std::min((size_t)r,iov->iov_len);
+            iov->iov_base=(char*)iov->iov_base+k;
+            iov->iov_len-=k;
+            r-=k;
+            if (iov->iov_len==0){
+                iov++;
+                iovcnt--;
+            }
+        }
+    }
+    return 0;
+}
+
+// io61_write_all(f, buf, sz, pos)
+//    Write all `sz` bytes of `buf` to `f`, at offset `pos` if `f` is
+//    seekable. Returns 0 on success and -1 on error.
+
+static int io61_write_all(io61_file* f, const char* buf, size_t sz, off_t pos) {
+    struct iovec iov={(void*)buf,sz};
+    return io61_writev_all(f,&iov,1,pos);
+}
+
+// io61_pread_all(f, buf, sz, pos)
+//    Read up to `sz` bytes at `pos` of `f` into `buf`, stopping early only
+//    at end of file. Returns the number of bytes read, or -1 on error.
+
+static ssize_t io61_pread_all(io61_file* f, char* buf, size_t sz, off_t pos) {
+    size_t nread=0;
+    while (nread<sz){
+        io61_count(f->stats.syscalls,1);
+        ssize_t r=pread(f->fd,buf+nread,sz-nread,pos+nread);
+        if (r<0 && errno==EINTR){
+            continue;
+        }
+        if (r<0){
+            return -1;
+        }
+        if (r==0){
+            break;
+        }
+        nread+=r;
+        if (f->direct && nread<sz){
+            //Direct reads are short only at end of file, and asking again
+            //at an unaligned offset would fail:
+            break;
+        }
+    }
+    return nread;
+}
+
+// io61_direct_off(f), io61_direct_on(f)
+//    Turn O_DIRECT off, then back on, around a transfer on direct file `f`
+//    that is not block-aligned. The lock keeps concurrent io61_pwrite
+//    calls from turning it back on under each other.
+
+static std::mutex io61_direct_mutex;
+
+static void io61_direct_off(io61_file* f) {
+    io61_direct_mutex.lock();
+    io61_count(f->stats.syscalls,1);
+    fcntl(f->fd,F_SETFL,f->fdflags&~O_DIRECT);
+}
+
+static void io61_direct_on(io61_file* f) {
+    io61_count(f->stats.syscalls,1);
+    fcntl(f->fd,F_SETFL,f->fdflags);
+    io61_direct_mutex.unlock();
+}
+
+// io61_zero(p, n)
+//    Return true if the `n` bytes at `p` (at least 8) are all zero: the
+//    first 8 are, and each byte equals the one 8 before it (memcmp is
+//    vectorized).
+
+static bool io61_zero(const char* p, size_t n) {
+    uint64_t x;
+    memcpy(&x,p,8);
+    return x==0 && memcmp(p,p+8,n-8)==0;
+}
+
+// io61_write_run(f, buf, sz, pos)
+//    io61_write_all for runs of a write slot. In sparse mode, aligned
+//    4096-byte blocks of zeros that would read as zeros anyway are not
+//    written, leaving holes (like cp --sparse); a hole at the end of the
+//    file is made by extending it at once, so the file always has the
+//    length written so far.
+//    On direct files the block-aligned middle of the run goes out with
+//    O_DIRECT, and only its unaligned head and tail through the page cache
+//    (as dd does for a short last block). `buf` must be aligned like
+//    `pos`. Returns 0 on success and -1 on error.
+
+static int io61_write_run(io61_file* f, const char* buf, size_t sz, off_t pos) {
+    if (f->sparse){
+        off_t end=pos+sz;
+        off_t done=pos;     //bytes before this are written or skipped
+        off_t b=(std::max(pos,f->hole_from)+cach_min-1)/cach_min*cach_min;
+        int r=0;
+        while (b+cach_min<=end){
+            if (!io61_zero(buf+(b-pos),cach_min) || !io61_unwritten(f,b,cach_min)){
+                b+=cach_min;
+                continue;
+            }
+            off_t e=b+cach_min;
+            while (e+cach_min<=end && io61_zero(buf+(e-pos),cach_min)
+                   && io61_unwritten(f,e,cach_min)){
+                e+=cach_min;
+            }
+            if (b>done && io61_write_all(f,buf+(done-pos),b-done,done)<0){
+                r=-1;
+            }
+            if (e>f->disk_size){
+                f->stats.syscalls++;
+                if (ftruncate(f->fd,e)<0){
+                    r=-1;
+                }
+                else{
+                    f->disk_size=e;
+                }
+            }
+            done=b=e;
+        }
+        if (end>done && io61_write_all(f,buf+(done-pos),end-done,done)<0){
+            r=-1;
+        }
+        return r;
+    }
+    if (!f->direct){
+        return io61_write_all(f,buf,sz,pos);
+    }
+    off_t end=pos+sz;
+    off_t a=std::min(end,(pos+cach_min-1)/cach_min*cach_min);
+    off_t b=std::max(a,end/cach_min*cach_min);
+    int r=0;
+    if (a>pos || b<end){
+        io61_direct_off(f);
+        if (a>pos && io61_write_all(f,buf,a-pos,pos)<0){
+            r=-1;
+        }
+        if (b<end && io61_write_all(f,buf+(b-pos),end-b,b)<0){
+            r=-1;
+        }
+        io61_direct_on(f);
+    }
+    if (b>a && io61_write_all(f,buf+(a-pos),b-a,a)<0){
+        r=-1;
+    }
+    return r;
+}
+
+// io61_writeback(f, ws)
+//    Write the dirty bytes of slot `ws` of `f` and mark it clean. A fully
+//    dirty slot takes one pwrite; otherwise each dirty run takes one.
+//    Returns 0 on success and -1 on error.
+
+static int io61_writeback(io61_file* f, io61_wslot* ws) {
+    int r=io61_async_wait(f);
+    if (ws->ndirty==(size_t)f->cach_size){
+        r=io61_write_run(f,ws->data,f->cach_size,ws->tag);
+    }
+    else if (ws->ndirty>0){
+        off_t i=ws->lo;
+        while (i<ws->hi){
+            //Skip clean bytes a word at a time:
+            unsigned long long w=ws->dirty[i/64]>>(i%64);
+            if (w==0){
+                i=(i/64+1)*64;
+                continue;
+            }
+            i+=__builtin_ctzll(w);
+            //Then find the end of the dirty run the same way:
+            off_t j=i;
+            while (j<ws->hi){
+                unsigned long long c=~ws->dirty[j/64]>>(j%64);
+                if (c==0){
+                    j=(j/64+1)*64;
+                    continue;
+                }
+                j+=__builtin_ctzll(c);
+                break;
+            }
+            j=std::min(j,ws->hi);
+            if (io61_write_run(f,&ws->data[i],j-i,ws->tag+i)<0){
+                r=-1;
+            }
+            i=j;
+        }
+    }
+    if (ws->ndirty>0){
+        memset(&ws->dirty[ws->lo/64],0,(ws->hi-1)/64*8-ws->lo/64*8+8);
+        f->stats.flushes++;
+    }
+    ws->ndirty=0;
+    ws->lo=f->cach_size;
+    ws->hi=0;
+    return r;
+}
+
+// io61_release_wslot(f, ws)
+//    Forget slot `ws` of `f` (which must be clean) and keep it for reuse.
+
+static void io61_release_wslot(io61_file* f, io61_wslot* ws) {
+    auto it=f->wslots.find(ws->tag/f->cach_size);
+    f->wlru.erase(it->second);
+    f->wslots.erase(it);
+    f->wfree.push_back(ws);
+    if (f->wcur==ws){
+        f->wcur=nullptr;
+    }
+}
+
+// io61_get_wslot(f, r)
+//    Return the slot of seekable file `f` for `f->cur_tag`, creating it if
+//    needed; when there are too many slots the least recently used one is
+//    written back (setting `r` to -1 if that fails). New slots of
+//    read-write files are read from the file, and are zeros past its end.
+//    Returns nullptr if that read fails.
+
+static io61_wslot* io61_get_wslot(io61_file* f, int& r) {
+    off_t block=f->cur_tag/f->cach_size;
+    auto it=f->wslots.find(block);
+    if (it!=f->wslots.end()){
+        f->wlru.splice(f->wlru.begin(),f->wlru,it->second);
+        return *it->second;
+    }
+    if (f->wslots.size()*f->cach_size>=wslot_budget){
+        io61_wslot* lru=f->wlru.back();
+        if (io61_writeback(f,lru)<0) r=-1;
+        io61_release_wslot(f,lru);
+    }
+    io61_wslot* ws;
+    if (!f->wfree.empty()){
+        ws=f->wfree.back();
+        f->wfree.pop_back();
+    }
+    else{
+        ws=new io61_wslot;
+        ws->data=io61_alloc(f->cach_size);
+        ws->dirty=new unsigned long long[f->cach_size/64];
+        memset(ws->dirty,0,f->cach_size/8);
+        ws->ndirty=0;
+        ws->lo=f->cach_size;
+        ws->hi=0;
     }
-    //If nothing was filled then this is the EOF:
-    return EOF;
+    ws->tag=block*f->cach_size;
+    if (f->mode==O_RDWR){
+        //Blocks past the end of the file need no read:
+        ssize_t n=0;
+        if (ws->tag<f->size){
+            f->stats.refills++;
+            n=io61_pread_all(f,ws->data,f->cach_size,ws->tag);
+        }
+        if (n<0){
+            f->wfree.push_back(ws);
+            return nullptr;
+        }
+        memset(ws->data+n,0,f->cach_size-n);
+    }
+    f->wlru.push_front(ws);
+    f->wslots[block]=f->wlru.begin();
+    return ws;
 }
 
+// io61_nb_write(f)
+//    io61_switch_wslot for nonblocking output `f`: write as much of its
+//    buffer as the descriptor takes now, and move the rest to the front.
+//    Returns 0 if the buffer has room, or -1 if a write failed or the
+//    buffer is still full (with `errno` EAGAIN).
 
+static int io61_nb_write(io61_file* f) {
+    io61_account(f);
+    size_t n=f->cur_tag-f->start_tag;
+    size_t done=0;
+    int err=0;
+    while (done<n){
+        f->stats.syscalls++;
+        ssize_t r=write(f->fd,f->cach+done,n-done);
+        if (r<0 && errno==EINTR){
+            continue;
+        }
+        if (r<=0){
+            err=(r<0 && errno!=EAGAIN && errno!=EWOULDBLOCK ? errno : 0);
+            break;
+        }
+        done+=r;
+    }
+    if (done>0){
+        f->stats.flushes++;
+        memmove(f->cach,f->cach+done,n-done);
+        f->start_tag+=done;
+        f->fd_tag+=done;
+    }
+    if (done==n){
+        f->pending_since=0;
+    }
+    f->run_tag=f->cur_tag;
+    f->wend_tag=f->start_tag+f->cach_size;
+    if (err || f->cur_tag>=f->wend_tag){
+        errno=(err ? err : EAGAIN);
+        return -1;
+    }
+    return 0;
+}
 
+// io61_switch_wslot(f)
+//    Make the write cache of `f` cover `f->cur_tag`. Unseekable files
+//    write out their buffer. Seekable files switch to the slot for
+//    `f->cur_tag` (see io61_get_wslot); a slot that just became fully
+//    dirty is written back at once, so sequential writers never keep more
+//    than one slot (read-write files keep it, clean, for reading). Returns
+//    0 on success and -1 on error.
 
+static int io61_switch_wslot(io61_file* f) {
+    io61_account(f);
+    if (f->cz){
+        return io61_cz_write_block(f);
+    }
+    if (f->nonblock){
+        return io61_nb_write(f);
+    }
+    if (!f->seekable){
+        int r=io61_async_wait(f);
+        if (f->cur_tag>f->start_tag){
+            f->stats.flushes++;
+        }
+        if (f->async && f->cur_tag>f->start_tag){
+            //Let the helper write this buffer while we fill the other:
+            io61_async_submit(f,true,f->cach,f->cur_tag-f->start_tag,-1);
+            f->fd_tag+=f->cur_tag-f->start_tag;
+            std::swap(f->cach,f->async->spare);
+            f->slots[0].data=f->cach;
+        }
+        else if (io61_write_all(f,f->cach,f->cur_tag-f->start_tag,0)<0){
+            r=-1;
+        }
+        f->start_tag=f->run_tag=f->cur_tag;
+        f->wend_tag=f->start_tag+f->cach_size;
+        f->pending_since=0;
+        return r;
+    }
+    int r=0;
+    io61_end_run(f);
+    if (f->wcur && f->wcur->ndirty==(size_t)f->cach_size && f->async){
+        //Let the helper write this slot back while we fill another one:
+        io61_wslot* ws=f->wcur;
+        r=io61_async_wait(f);
+        auto it=f->wslots.find(ws->tag/f->cach_size);
+        f->wlru.erase(it->second);
+        f->wslots.erase(it);
+        f->wcur=nullptr;
+        f->async->slot=ws;
+        f->stats.flushes++;
+        io61_async_submit(f,true,ws->data,f->cach_size,ws->tag);
+    }
+    else if (f->wcur && f->wcur->ndirty==(size_t)f->cach_size){
+        r=io61_writeback(f,f->wcur);
+        if (f->mode!=O_RDWR){
+            io61_release_wslot(f,f->wcur);
+        }
+    }
+    io61_wslot* ws=io61_get_wslot(f,r);
+    if (!ws){
+        f->start_tag=f->end_tag=f->wend_tag=f->run_tag=f->cur_tag;
+        return -1;
+    }
+    f->wcur=ws;
+    f->cach=ws->data;
+    f->start_tag=ws->tag;
+    f->wend_tag=ws->tag+f->cach_size;
+    //Reads must go through io61_rw_fill, which ends the run:
+    f->end_tag=f->start_tag;
+    f->run_tag=f->cur_tag;
+    return r;
+}
 
-// io61_read(f, buf, sz)
-//    Read up to `sz` characters from `f` into `buf`. Returns the number of
-//    characters read on success; normally this is `sz`. Returns a short
-//    count, which might be zero, if the file ended before `sz` characters
-//    could be read. Returns -1 if an error occurred before any characters
-//    were read.
+// io61_rw_fill(f)
+//    io61_fill for read-write file `f`: end the write run, if any, and
+//    open the read window on the slot for `f->cur_tag`, up to the end of
+//    the file. The write window closes, so the next write goes through
+//    io61_switch_wslot and starts a new run; a run never covers bytes
+//    that were only read. Returns the number of bytes available after
+//    `f->cur_tag`, 0 at end-of-file, or -1 on error.
 
-ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
-    //Can we fullfill this read from the cache?
-    if ((signed)sz<=f->end_tag-f->cur_tag){
-        memcpy((void*)buf,(void*)&f->cach[f->cur_tag-f->start_tag],sz);
-        f->cur_tag+=sz;
-        return sz;
+static ssize_t io61_rw_fill(io61_file* f) {
+    io61_end_run(f);
+    int r=0;
+    io61_wslot* ws=nullptr;
+    if (f->cur_tag<f->size){
+        ws=io61_get_wslot(f,r);
     }
-    //Let's read the bytes we already have:
-    memcpy((void*)buf,(void*)&f->cach[f->cur_tag-f->start_tag],f->end_tag-f->cur_tag);
-    size_t nread = f->end_tag-f->cur_tag;
-    if (sz-nread>cach_size){
-        //If one more fill will still not be enough then it is better
-        //to read directly from the file instead of having a loop of fills
-        nread+=read(f->fd,(void*)&buf[nread],sz-nread);
-        f->cur_tag+=nread;
-        f->end_tag=f->start_tag=f->cur_tag;
-        return nread;
-    }
-    //Do a fill and then get the rest of the bytes that you want:
-    f->cur_tag+=nread;
-    io61_fill(f);
-    if ((int)(sz-nread)<=f->end_tag-f->cur_tag){
-        //Can we get all the bytes we need?:
-        memcpy((void*)&buf[nread],(void*)&f->cach[f->cur_tag-f->start_tag],sz-nread);
-        f->cur_tag+=sz-nread;
-        return sz;
+    if (!ws){
+        f->start_tag=f->end_tag=f->wend_tag=f->run_tag=f->cur_tag;
+        return f->cur_tag<f->size || r<0 ? -1 : 0;
     }
-    //Get the rest of the bytes available:
-    memcpy((void*)&buf[nread],(void*)&f->cach[f->cur_tag-f->start_tag],f->end_tag-f->cur_tag);
-    f->cur_tag=f->end_tag;
-    return nread+f->end_tag-f->cur_tag;
-
+    f->wcur=ws;
+    f->cach=ws->data;
+    f->start_tag=ws->tag;
+    f->end_tag=std::min(ws->tag+f->cach_size,f->size);
+    f->wend_tag=f->start_tag;
+    f->run_tag=f->cur_tag;
+    return r<0 ? -1 : f->end_tag-f->cur_tag;
 }
 
-
 // io61_writec(f)
 //    Write a single character `ch` to `f`. Returns 0 on success or
 //    -1 on error.
 
 int io61_writec(io61_file* f, int ch) {
     //Can we still write to the cache?
-    if (f->end_tag-f->start_tag<cach_size){
-        f->cach[f->end_tag-f->start_tag]=ch;
-        f->end_tag++;
+    if (f->cur_tag>=f->start_tag && f->cur_tag<f->wend_tag){
+        f->cach[f->cur_tag-f->start_tag]=ch;
+        f->cur_tag++;
+        if (f->peer){
+            io61_duplex_wrote(f);
+        }
         return 0;
     }
-    //If our cache is full then we flush and write to the cach:
-    io61_flush(f);
-    f->cach[0]=ch;
-    f->end_tag++;
+    //If our cache doesn't cover this position then we switch slots (or
+    //flush) and write to the cach:
+    if (io61_switch_wslot(f)<0){
+        return -1;
+    }
+    f->cach[f->cur_tag-f->start_tag]=ch;
+    f->cur_tag++;
+    if (f->peer){
+        io61_duplex_wrote(f);
+    }
     return 0;
 }
 
@@ -156,35 +2621,43 @@ int io61_writec(io61_file* f, int ch) {
 //    an error occurred before any characters were written.
 
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
-    size_t cach_used=f->end_tag-f->start_tag;
-    //Can we write it all to the cache?
-    if (cach_size-cach_used>=sz){
-        memcpy((void*)&f->cach[cach_used],(void*)buf,sz);
-        f->end_tag+=sz;
-        return sz;
+    struct iovec iov={(void*)buf,sz};
+    return io61_writev(f,&iov,1);
+}
+
+
+// io61_reserve(f, ptr, len)
+//    Make `*ptr` point at the cache space at the current position of
+//    writable file `f` and set `*len` to how much there is, making room if
+//    there is none. Bytes stored there are written by io61_commit; `*ptr`
+//    is valid until the next call on `f`. Returns 0 on success and -1 on
+//    error.
+
+int io61_reserve(io61_file* f, char** ptr, size_t* len) {
+    if (f->mode==O_RDONLY
+        || ((f->cur_tag<f->start_tag || f->cur_tag>=f->wend_tag)
+            && io61_switch_wslot(f)<0)){
+        *ptr=nullptr;
+        *len=0;
+        return -1;
     }
-    if (sz-(cach_size-cach_used)>=cach_size){
-        //If the remaining bytes in the cache plus one more cache will
-        //not be enough for all our writes then it's better to write
-        //directly to the file:
-        io61_flush(f);
-        size_t nwritten = write(f->fd,(void*)buf,sz);
-        if (nwritten != 0 || sz == 0) {
-            f->end_tag+=nwritten;
-            f->start_tag=f->end_tag;
-            return nwritten;
-        } else {
-            return -1;
-        }
+    *ptr=&f->cach[f->cur_tag-f->start_tag];
+    *len=f->wend_tag-f->cur_tag;
+    return 0;
+}
+
+
+// io61_commit(f, n)
+//    Write the first `n` bytes at the `*ptr` io61_reserve returned by
+//    advancing the position of `f` past them. `n` must not exceed the
+//    `*len` io61_reserve reported.
+
+void io61_commit(io61_file* f, size_t n) {
+    assert(f->cur_tag>=f->start_tag && (off_t)n<=f->wend_tag-f->cur_tag);
+    f->cur_tag+=n;
+    if (f->peer){
+        io61_duplex_wrote(f);
     }
-    //Let's fill the rest of this cache and flush it:
-    memcpy((void*)&f->cach[cach_used],(void*)buf,cach_size-cach_used);
-    f->end_tag=f->start_tag+cach_size;
-    io61_flush(f);
-    //Then fill a new cache with the rest of our writes:
-    memcpy((void*)f->cach,(void*)&buf[cach_size-cach_used],sz-(cach_size-cach_used));
-    f->end_tag+=sz-(cach_size-cach_used);
-    return sz;
 }
 
 
@@ -194,50 +2667,810 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
 //    data buffered for reading, or do nothing.
 
 int io61_flush(io61_file* f) {
-    (void) f;
-    if (f->end_tag>f->start_tag){
-        int nwritten=write(f->fd,(void*)f->cach,f->end_tag-f->start_tag);
-        if (nwritten<=0){
-            f->start_tag = f->cur_tag = f->end_tag;
+    if (f->mode==O_RDONLY){
+        return 0;
+    }
+    io61_account(f);
+    if (f->cz){
+        int r=io61_cz_write_block(f);
+        return io61_flush(f->cz->inner)<0 ? -1 : r;
+    }
+    if (f->nonblock){
+        if (io61_nb_write(f)<0){
+            return -1;
+        }
+        if (f->cur_tag>f->start_tag){
+            errno=EAGAIN;
             return -1;
         }
+        return 0;
     }
-    f->start_tag = f->cur_tag = f->end_tag;
-    return 0;
+    if (!f->seekable){
+        int r=io61_switch_wslot(f);
+        return io61_async_wait(f)<0 ? -1 : r;
+    }
+    //Write every dirty slot back in file order:
+    io61_end_run(f);
+    int r=io61_async_wait(f);
+    std::vector<io61_wslot*> dirty(f->wlru.begin(),f->wlru.end());
+    std::sort(dirty.begin(),dirty.end(),
+              [](io61_wslot* a, io61_wslot* b) { return a->tag<b->tag; });
+    for (io61_wslot* ws:dirty){
+        if (io61_writeback(f,ws)<0){
+            r=-1;
+        }
+        //Read-write files keep reading from their slots:
+        if (f->mode!=O_RDWR){
+            io61_release_wslot(f,ws);
+        }
+    }
+    f->start_tag=f->end_tag=f->wend_tag=f->run_tag=f->cur_tag;
+    if (io61_sync_offset(f)<0){
+        r=-1;
+    }
+    return r;
+}
+
+// io61_write_direct(f, iov, iovcnt)
+//    Write the caller's buffers `iov` at `f->cur_tag` straight to the file.
+//    The bytes buffered just before them go out in the same writev/pwritev
+//    when they are the only buffered bytes; other dirty slots are flushed
+//    first. Leaves the cache empty. Returns the number of bytes written
+//    from `iov`, or -1 on error.
+
+static ssize_t io61_write_direct(io61_file* f, const struct iovec* iov, int iovcnt) {
+    io61_account(f);
+    struct iovec v[IOV_MAX];
+    int n=0;
+    off_t pos=f->cur_tag;
+    if (io61_async_wait(f)<0){
+        return -1;
+    }
+    if (!f->seekable){
+        if (f->cur_tag>f->start_tag){
+            v[n].iov_base=f->cach;
+            v[n++].iov_len=f->cur_tag-f->start_tag;
+        }
+    }
+    else if (f->wcur && f->wcur->ndirty==0 && f->wslots.size()==1
+             && f->cur_tag>f->run_tag){
+        //Our only dirty bytes are the run that ends where the caller's
+        //data starts. The slot's memory stays valid until it is reused:
+        io61_wslot* ws=f->wcur;
+        v[n].iov_base=&ws->data[f->run_tag-ws->tag];
+        v[n++].iov_len=f->cur_tag-f->run_tag;
+        pos=f->run_tag;
+        f->run_tag=f->cur_tag;
+        io61_release_wslot(f,ws);
+    }
+    else if (io61_flush(f)<0){
+        return -1;
+    }
+    if (n>0){
+        f->stats.flushes++;
+    }
+    size_t total=0;
+    for (int i=0; i<iovcnt && n<IOV_MAX; i++){
+        v[n++]=iov[i];
+        total+=iov[i].iov_len;
+    }
+    int r=io61_writev_all(f,v,n,pos);
+    if (r==0){
+        f->cur_tag+=total;
+    }
+    f->start_tag=f->end_tag=f->wend_tag=f->run_tag=f->sum_tag=f->cur_tag;
+    if (!f->seekable){
+        f->wend_tag=f->start_tag+f->cach_size;
+        f->pending_since=0;
+    }
+    return r<0 ? -1 : total;
+}
+
+
+// io61_writev(f, iov, iovcnt)
+//    Write the `iovcnt` buffers `iov` in order, like io61_write. Large
+//    writes go straight to the file with one writev that also carries the
+//    buffered bytes before them.
+
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt) {
+    size_t total=0;
+    for (int i=0; i<iovcnt; i++){
+        total+=iov[i].iov_len;
+    }
+    size_t nwritten=0;
+    int i=0;
+    size_t off=0;   //bytes already written from iov[i]
+    bool failed=false;
+    while (i<iovcnt){
+        if (off==iov[i].iov_len){
+            i++;
+            off=0;
+            continue;
+        }
+        const char* src=(const char*)iov[i].iov_base+off;
+        size_t want=iov[i].iov_len-off;
+        //Copy as much as the cache can hold at our position:
+        if (f->cur_tag>=f->start_tag && f->cur_tag<f->wend_tag){
+            size_t n=std::min((size_t)(f->wend_tag-f->cur_tag),want);
+            memcpy(&f->cach[f->cur_tag-f->start_tag],src,n);
+            f->cur_tag+=n;
+            off+=n;
+            nwritten+=n;
+            continue;
+        }
+        if (!f->cz && !f->direct && !f->nonblock && f->mode!=O_RDWR
+            && total-nwritten>=(size_t)f->cach_size){
+            //If the rest will not fit in one more cache then it is better
+            //to write directly to the file:
+            struct iovec rest[IOV_MAX];
+            int n=0;
+            rest[n].iov_base=(void*)src;
+            rest[n++].iov_len=want;
+            for (int j=i+1; j<iovcnt && n<IOV_MAX-1; j++){
+                rest[n++]=iov[j];
+            }
+            ssize_t r=io61_write_direct(f,rest,n);
+            if (r<0){
+                failed=true;
+                break;
+            }
+            io61_sumv(f,rest,n,r);
+            f->stats.nwritten+=r;
+            nwritten+=r;
+            //Move past the buffers we wrote:
+            for (size_t left=r; left>0; ){
+                size_t k=std::min(left,iov[i].iov_len-off);
+                off+=k;
+                left-=k;
+                if (off==iov[i].iov_len && left>0){
+                    i++;
+                    off=0;
+                }
+            }
+            continue;
+        }
+        if (io61_switch_wslot(f)<0){
+            failed=true;
+            break;
+        }
+    }
+    if (f->peer){
+        io61_duplex_wrote(f);
+    }
+    return failed && nwritten==0 ? -1 : nwritten;
 }
 
+
 // io61_seek(f, pos)
 //    Change the file pointer for file `f` to `pos` bytes into the file.
 //    Returns 0 on success and -1 on failure.
 
 int io61_seek(io61_file* f, off_t pos) {
-    if (f->mode==O_RDONLY){
-        //Is the desired position within our cache:
-        if (pos>=f->start_tag && pos<f->end_tag){
-            f->cur_tag=pos;
-            return 0;
+    io61_account(f);
+    if (f->cz){
+        int r=io61_cz_seek(f,pos);
+        f->sum_tag=f->cur_tag;
+        return r;
+    }
+    if (!f->seekable || pos<0){
+        if (f->mode!=O_RDONLY){
+            io61_flush(f);
         }
-        //Let's seek to the new position and update the tags:
-        off_t r = lseek(f->fd, (off_t) pos, SEEK_SET);
-        if (r == (off_t) pos) {
-            f->end_tag=f->start_tag=f->cur_tag=pos;
+        return -1;
+    }
+    if (f->mode!=O_RDONLY){
+        //Written bytes stay in their slot until it is written back; the
+        //next write after the seek starts a new run:
+        io61_end_run(f);
+    }
+    //Reads and writes check that cur_tag is inside the cache, so just
+    //moving cur_tag is enough:
+    f->cur_tag=f->run_tag=f->sum_tag=pos;
+    f->stats.seeks++;
+    return 0;
+}
+
+
+// io61_pread(f, buf, sz, off)
+//    Read up to `sz` characters at file offset `off` of `f` into `buf`,
+//    without using or moving the position of `f`. Several threads may call
+//    io61_pread on one io61_file at once (but not other io61 functions).
+//    Mapped files are copied from the mapping. Other files go through a
+//    shared cache of aligned blocks, except for requests of a block or
+//    more, which are read straight into `buf`. Returns the number of
+//    characters read, which is less than `sz` only at end of file, or -1
+//    if an error occurred before any characters were read.
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off) {
+    if (f->mode!=O_RDONLY || !f->seekable || f->cz || off<0){
+        errno=(f->mode!=O_RDONLY ? EBADF : f->seekable ? EINVAL : ESPIPE);
+        return -1;
+    }
+    if (f->mapped){
+        if (off>=f->end_tag){
             return 0;
         }
-        else {
+        size_t n=std::min(sz,(size_t)(f->end_tag-off));
+        memcpy(buf,f->cach+off,n);
+        io61_count(f->stats.hits,n);
+        io61_count(f->stats.nread,n);
+        return n;
+    }
+    io61_pcache* pc=f->pcache;
+    off_t bs=pc->block_size;
+    size_t nread=0, ncached=0;
+    bool missed=false, failed=false;
+    while (nread<sz){
+        off_t pos=off+nread;
+        if (sz-nread>=(size_t)bs && !f->direct){
+            missed=true;
+            ssize_t r=io61_pread_all(f,buf+nread,sz-nread,pos);
+            if (r<0){
+                failed=true;
+                break;
+            }
+            nread+=r;
+            break;
+        }
+        off_t block=pos/bs;
+        std::unique_lock<std::mutex> lock(pc->m);
+        auto it=pc->blocks.find(block);
+        if (it==pc->blocks.end()){
+            //Read the block without holding the lock, so other threads'
+            //hits and misses go ahead meanwhile:
+            lock.unlock();
+            missed=true;
+            char* data=io61_alloc(bs);
+            ssize_t r=io61_pread_all(f,data,bs,block*bs);
+            if (r<0){
+                io61_free(data,bs);
+                failed=true;
+                break;
+            }
+            lock.lock();
+            it=pc->blocks.find(block);
+            if (it!=pc->blocks.end()){
+                //Another thread read it first:
+                io61_free(data,bs);
+            }
+            else{
+                if (pc->blocks.size()>=pcache_blocks){
+                    auto lru=pc->blocks.begin();
+                    for (auto j=pc->blocks.begin(); j!=pc->blocks.end(); ++j){
+                        if (j->second.used<lru->second.used){
+                            lru=j;
+                        }
+                    }
+                    io61_free(lru->second.data,bs);
+                    pc->blocks.erase(lru);
+                }
+                it=pc->blocks.emplace(block,io61_pblock{data,r,0}).first;
+            }
+        }
+        io61_pblock& b=it->second;
+        b.used=++pc->clock;
+        off_t within=pos-block*bs;
+        if (within>=b.end){
+            break;
+        }
+        size_t n=std::min(sz-nread,(size_t)(b.end-within));
+        memcpy(buf+nread,b.data+within,n);
+        nread+=n;
+        ncached+=n;
+    }
+    if (missed){
+        io61_count(f->stats.misses,1);
+    }
+    io61_count(f->stats.hits,ncached);
+    io61_count(f->stats.nread,nread);
+    return failed && nread==0 ? -1 : nread;
+}
+
+// io61_pwrite(f, buf, sz, off)
+//    Write `sz` characters from `buf` at file offset `off` of the seekable
+//    file `f`, without using or moving its position or its cache. Several
+//    threads may call io61_pwrite on one io61_file at once. Bytes also
+//    written with io61_write and not yet flushed will overwrite these
+//    when flushed; on read-write files the cached copies are updated
+//    instead, so later reads and flushes see these bytes. Returns `sz` on
+//    success or -1 on error.
+
+ssize_t io61_pwrite(io61_file* f, const char* buf, size_t sz, off_t off) {
+    if (f->mode==O_RDONLY || !f->seekable || f->cz || off<0){
+        errno=(f->mode==O_RDONLY ? EBADF : f->seekable ? EINVAL : ESPIPE);
+        return -1;
+    }
+    int r;
+    if (f->direct && ((uintptr_t)buf%cach_min || sz%cach_min || off%cach_min)){
+        io61_direct_off(f);
+        r=io61_write_all(f,buf,sz,off);
+        io61_direct_on(f);
+    }
+    else{
+        r=io61_write_all(f,buf,sz,off);
+    }
+    if (r<0){
+        return -1;
+    }
+    if (f->mode==O_RDWR){
+        //Keep cached copies of these bytes up to date (io61_write_all
+        //updated the size):
+        static std::mutex m;
+        std::lock_guard<std::mutex> guard(m);
+        for (off_t b=off/f->cach_size; b<=(off_t)(off+sz-1)/f->cach_size && sz>0; b++){
+            auto it=f->wslots.find(b);
+            if (it!=f->wslots.end()){
+                io61_wslot* ws=*it->second;
+                off_t lo=std::max(off,ws->tag), hi=std::min((off_t)(off+sz),ws->tag+f->cach_size);
+                memcpy(ws->data+(lo-ws->tag),buf+(lo-off),hi-lo);
+            }
+        }
+    }
+    io61_count(f->stats.nwritten,sz);
+    return sz;
+}
+
+
+// io61_preallocate(f, size)
+//    Reserve disk space for the first `size` bytes of the seekable output
+//    `f`, so later writes neither fail for lack of space nor fragment the
+//    file. On Linux the file's length does not change, so it is always as
+//    long as the bytes written; space that is not written is released at
+//    close. Elsewhere posix_fallocate extends the file, and close cuts it
+//    back to the bytes written (or its original size, if longer), so a
+//    file that is never closed keeps the preallocated length. Returns 0 on
+//    success and -1 on error; on file systems without preallocation,
+//    returns -1 with `errno` EOPNOTSUPP and changes nothing.
+
+int io61_preallocate(io61_file* f, off_t size) {
+    if (f->mode==O_RDONLY || !f->seekable || f->cz || size<0){
+        errno=(f->mode==O_RDONLY ? EBADF : f->seekable ? EINVAL : ESPIPE);
+        return -1;
+    }
+    if (size<=std::max(f->size,f->prealloc)){
+        return 0;
+    }
+    f->stats.syscalls++;
+#if __linux__
+    int r=fallocate(f->fd,FALLOC_FL_KEEP_SIZE,0,size)<0 ? errno : 0;
+#else
+    int r=posix_fallocate(f->fd,0,size);
+#endif
+    if (r!=0){
+        errno=(r==EINVAL || r==ENOSYS ? EOPNOTSUPP : r);
+        return -1;
+    }
+    //The preallocated blocks read as zeros, so skipping zero blocks (and
+    //leaving them allocated) is still correct:
+    f->prealloc=size;
+    return 0;
+}
+
+// io61_unreserve(f)
+//    Give back the space io61_preallocate reserved for `f` past the bytes
+//    written. Returns 0 on success and -1 on error.
+
+static int io61_unreserve(io61_file* f) {
+    struct stat s;
+    f->stats.syscalls++;
+    if (fstat(f->fd,&s)<0){
+        return -1;
+    }
+    if (s.st_size>=f->prealloc){
+        return 0;
+    }
+    f->stats.syscalls++;
+#if __linux__
+    //Unwritten space lies past the end of the file, and truncating to the
+    //length it has frees it:
+    return ftruncate(f->fd,s.st_size);
+#else
+    //posix_fallocate extended the file:
+    return s.st_size!=f->size && ftruncate(f->fd,f->size)<0 ? -1 : 0;
+#endif
+}
+
+
+// io61_sparse(f)
+//    Put seekable regular output `f` in sparse mode: from now on, aligned
+//    blocks of zeros written past the current end of the file are skipped
+//    rather than written, leaving holes that read as zeros (like cp
+//    --sparse). The file still always has the length written so far.
+//    Sparse files must not take concurrent io61_pwrite calls. Returns 0
+//    on success and -1 (with `errno` EINVAL) if `f` is not a seekable
+//    regular write-only file, or is direct, asynchronous or compressed.
+
+int io61_sparse(io61_file* f) {
+    struct stat s;
+    if (f->mode!=O_WRONLY || !f->seekable || f->direct || f->async || f->cz
+        || fstat(f->fd,&s)<0 || !S_ISREG(s.st_mode)){
+        errno=EINVAL;
+        return -1;
+    }
+    f->stats.syscalls++;
+    if (!f->sparse){
+        io61_end_run(f);
+        f->hole_from=std::max(f->size,(off_t)s.st_size);
+        f->disk_size=s.st_size;
+        f->sparse=true;
+    }
+    return 0;
+}
+
+
+// io61_kernel_copy(inf, outf, sz)
+//    Try to copy up to `sz` bytes from `inf` at `inf->cur_tag` to the
+//    descriptor position of `outf` without passing through user space.
+//    Both caches must be empty. Returns the number of bytes copied, 0 at
+//    end-of-file, or -1 if the kernel cannot copy between these files (or
+//    failed), in which case nothing was copied.
+
+static ssize_t io61_kernel_copy(io61_file* inf, io61_file* outf, size_t sz) {
+#if __linux__
+    struct stat ins, outs;
+    if (fstat(inf->fd,&ins)<0 || fstat(outf->fd,&outs)<0){
+        return -1;
+    }
+    io61_account(inf);
+    io61_account(outf);
+    //Regular inputs are read at an explicit offset, so mapped files and
+    //the descriptor position stay consistent:
+    off_t off=inf->cur_tag;
+    off_t* offp=inf->seekable ? &off : nullptr;
+    //Output goes through the descriptor offset, so put it in place:
+    if (outf->seekable && outf->fd_tag!=outf->cur_tag){
+        outf->stats.syscalls++;
+        if (lseek(outf->fd,outf->cur_tag,SEEK_SET)!=outf->cur_tag){
+            return -1;
+        }
+        outf->fd_tag=outf->cur_tag;
+    }
+    ssize_t r=-1;
+    if (S_ISREG(ins.st_mode) && S_ISREG(outs.st_mode)){
+        inf->stats.syscalls++;
+        r=copy_file_range(inf->fd,offp,outf->fd,nullptr,sz,0);
+    }
+    if (r<0 && S_ISREG(ins.st_mode)){
+        inf->stats.syscalls++;
+        r=sendfile(outf->fd,inf->fd,offp,sz);
+    }
+    if (r<0 && (S_ISFIFO(ins.st_mode) || S_ISFIFO(outs.st_mode))){
+        inf->stats.syscalls++;
+        r=splice(inf->fd,offp,outf->fd,nullptr,sz,SPLICE_F_MOVE);
+    }
+    if (r<0){
+        return -1;
+    }
+    inf->stats.nread+=r;
+    outf->stats.nwritten+=r;
+    inf->cur_tag+=r;
+    if (!inf->seekable){
+        inf->fd_tag=inf->cur_tag;
+    }
+    if (!inf->mapped){
+        //(A mapping still covers the whole file, whatever its size now.)
+        inf->start_tag=inf->end_tag=inf->cur_tag;
+    }
+    if (outf->seekable){
+        io61_wrote(outf,outf->fd_tag,r);
+    }
+    outf->fd_tag+=r;
+    outf->cur_tag=outf->run_tag=outf->sum_tag=outf->fd_tag;
+    inf->sum_tag=inf->cur_tag;
+    outf->start_tag=outf->end_tag=outf->wend_tag=outf->cur_tag;
+    if (!outf->seekable){
+        outf->wend_tag=outf->start_tag+outf->cach_size;
+    }
+    return r;
+#else
+    (void) inf, (void) outf, (void) sz;
+    return -1;
+#endif
+}
+
+
+// io61_copy(inf, outf, sz)
+//    Copy up to `sz` bytes from read-only file `inf` to write-only file
+//    `outf`, stopping early at end-of-file. Buffered data is drained
+//    first; the rest moves inside the kernel (copy_file_range, sendfile,
+//    or splice) when both files allow it, and through the cache
+//    otherwise. Returns the number of bytes copied, or -1 if an error
+//    occurred before any bytes were copied.
+
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t sz) {
+    assert(inf->mode==O_RDONLY && outf->mode!=O_RDONLY);
+    size_t ncopied=0;
+    //Bytes already in a (non-mapped) read cache must go through outf's cache:
+    if (!inf->mapped && inf->cur_tag<inf->end_tag && inf->cur_tag>=inf->start_tag){
+        size_t n=std::min((size_t)(inf->end_tag-inf->cur_tag),sz);
+        if (io61_write(outf,&inf->cach[inf->cur_tag-inf->start_tag],n)!=(ssize_t)n){
             return -1;
         }
+        inf->cur_tag+=n;
+        ncopied+=n;
+    }
+    if (ncopied<sz && io61_flush(outf)<0){
+        return ncopied ? (ssize_t)ncopied : -1;
+    }
+    //The helper thread of an asynchronous input may be reading its
+    //descriptor, compressed files need their bytes to pass through us,
+    //duplex inputs must not block inside the kernel, direct files need
+    //aligned transfers, read-write outputs keep cached copies,
+    //checksums need to see the bytes, and nonblocking files may take
+    //only part of a transfer:
+    bool kernel_ok=!inf->async && !inf->cz && !outf->cz && !inf->peer
+        && !inf->direct && !outf->direct && outf->mode!=O_RDWR
+        && !inf->digest && !outf->digest && !inf->nonblock && !outf->nonblock;
+    while (ncopied<sz){
+        if (kernel_ok){
+            ssize_t r=io61_kernel_copy(inf,outf,sz-ncopied);
+            if (r==0){
+                break;
+            }
+            if (r>0){
+                ncopied+=r;
+                continue;
+            }
+            kernel_ok=false;
+        }
+        //Fall back to copying through the caches:
+        const char* p;
+        size_t n;
+        if (io61_peek(inf,&p,&n)<0){
+            return ncopied ? (ssize_t)ncopied : -1;
+        }
+        if (n==0){
+            break;
+        }
+        n=std::min(n,sz-ncopied);
+        if (io61_write(outf,p,n)!=(ssize_t)n){
+            return ncopied ? (ssize_t)ncopied : -1;
+        }
+        io61_consume(inf,n);
+        ncopied+=n;
+    }
+    return ncopied;
+}
+
+
+// io61_poller
+//    Waits on many nonblocking io61_files at once with epoll. Files with
+//    bytes already buffered are ready without asking the kernel, and
+//    buffered output of every registered file is written out as its
+//    descriptor drains, so callers never flush. Descriptors are
+//    registered only while there is something to wait for.
+
+struct io61_poll_entry {
+    io61_file* f;
+    int events;         //the caller's POLLIN/POLLOUT interest
+    void* data;
+    int fd;             //registered descriptor: f->fd, or a dup if that was taken
+    uint32_t mask;      //epoll events registered; 0 if not registered
+};
+
+struct io61_poller {
+    int epfd;
+    std::unordered_map<io61_file*, io61_poll_entry> entries;
+    std::vector<io61_poll_entry*> ready;
+};
+
+// io61_poll_ready(f)
+//    Return the POLLIN/POLLOUT events nonblocking `f` can serve without a
+//    system call: buffered input, or room in its output buffer.
+
+static int io61_poll_ready(io61_file* f) {
+    if (f->mode==O_RDONLY){
+        return f->cur_tag<f->end_tag && f->cur_tag>=f->start_tag ? POLLIN : 0;
+    }
+    return f->cur_tag==f->start_tag || f->cur_tag<f->wend_tag ? POLLOUT : 0;
+}
+
+// io61_poller_open()
+//    Return a new, empty io61_poller, or nullptr on error.
+
+io61_poller* io61_poller_open() {
+#if __linux__
+    int epfd=epoll_create1(EPOLL_CLOEXEC);
+    if (epfd<0){
+        return nullptr;
+    }
+    io61_poller* p=new io61_poller;
+    p->epfd=epfd;
+    return p;
+#else
+    errno=ENOSYS;
+    return nullptr;
+#endif
+}
+
+// io61_poller_close(p)
+//    Free io61_poller `p`. Its files stay open.
+
+int io61_poller_close(io61_poller* p) {
+    for (auto& it:p->entries){
+        if (it.second.fd!=it.first->fd){
+            close(it.second.fd);
+        }
+    }
+    int r=close(p->epfd);
+    delete p;
+    return r;
+}
+
+// io61_poller_add(p, f, events, data)
+//    Watch io61_file `f`, which must be in nonblocking mode, for `events`
+//    (POLLIN, POLLOUT, or both; 0 only drains its output). io61_poller_wait
+//    reports `data` with it. Calling io61_poller_add for a file already
+//    watched changes its events and data. Returns 0 on success and -1 on
+//    error.
+
+int io61_poller_add(io61_poller* p, io61_file* f, int events, void* data) {
+    if (!f->nonblock){
+        errno=EINVAL;
+        return -1;
+    }
+    auto it=p->entries.find(f);
+    if (it==p->entries.end()){
+        it=p->entries.emplace(f,io61_poll_entry{f,0,nullptr,f->fd,0}).first;
+    }
+    it->second.events=events&(POLLIN|POLLOUT);
+    it->second.data=data;
+    return 0;
+}
+
+// io61_poller_remove(p, f)
+//    Stop watching `f`. Do this before closing it. Returns 0 on success
+//    and -1 if `f` was not watched.
 
+int io61_poller_remove(io61_poller* p, io61_file* f) {
+    auto it=p->entries.find(f);
+    if (it==p->entries.end()){
+        errno=ENOENT;
+        return -1;
+    }
+    io61_poll_entry& e=it->second;
+#if __linux__
+    if (e.mask){
+        epoll_ctl(p->epfd,EPOLL_CTL_DEL,e.fd,nullptr);
     }
-    //If it is a write file we should flush, seek, and update the tags:
-    io61_flush(f);
-    off_t r = lseek(f->fd, (off_t) pos, SEEK_SET);
-    if (r == (off_t) pos) {
-        f->end_tag=f->start_tag=pos;
+#endif
+    if (e.fd!=f->fd){
+        close(e.fd);
+    }
+    p->entries.erase(it);
+    return 0;
+}
+
+#if __linux__
+// io61_poll_register(p, e, mask)
+//    Make the epoll registration of `e` wait for `mask`. Two files on one
+//    descriptor (the halves of a socket) need two registrations, so the
+//    second gets a duplicate descriptor. Returns 0 or -1.
+
+static int io61_poll_register(io61_poller* p, io61_poll_entry& e, uint32_t mask) {
+    if (mask==e.mask){
         return 0;
     }
-    else {
+    struct epoll_event ev;
+    ev.events=mask;
+    ev.data.ptr=&e;
+    int r;
+    if (!mask){
+        r=epoll_ctl(p->epfd,EPOLL_CTL_DEL,e.fd,nullptr);
+    }
+    else if (e.mask){
+        r=epoll_ctl(p->epfd,EPOLL_CTL_MOD,e.fd,&ev);
+    }
+    else{
+        r=epoll_ctl(p->epfd,EPOLL_CTL_ADD,e.fd,&ev);
+        if (r<0 && errno==EEXIST && e.fd==e.f->fd){
+            e.fd=fcntl(e.f->fd,F_DUPFD_CLOEXEC,0);
+            r=(e.fd<0 ? -1 : epoll_ctl(p->epfd,EPOLL_CTL_ADD,e.fd,&ev));
+            if (e.fd<0){
+                e.fd=e.f->fd;
+            }
+        }
+    }
+    e.f->stats.syscalls++;
+    if (r==0){
+        e.mask=mask;
+    }
+    return r;
+}
+#endif
+
+// io61_poller_wait(p, evs, maxevents, timeout)
+//    Wait up to `timeout` milliseconds (-1 means forever) for watched
+//    files to become ready, and store up to `maxevents` of them in `evs`:
+//    POLLIN means io61_read will not fail with EAGAIN (it may return 0 at
+//    end-of-file), and POLLOUT means io61_write will take at least one
+//    byte or report an error. Returns the number of events stored, 0 on
+//    timeout (or if the kernel only woke us to write out buffered
+//    output), or -1 on error. `maxevents` must be positive.
+
+int io61_poller_wait(io61_poller* p, io61_event* evs, int maxevents, int timeout) {
+    if (maxevents<=0){
+        errno=EINVAL;
         return -1;
     }
+#if __linux__
+    //Write out buffered output and see what is ready already:
+    p->ready.clear();
+    for (auto& it:p->entries){
+        io61_poll_entry& e=it.second;
+        io61_file* f=e.f;
+        bool pending=f->mode!=O_RDONLY && f->cur_tag>f->start_tag;
+        if (pending){
+            pending=io61_flush(f)<0 && errno==EAGAIN;
+        }
+        int ready=io61_poll_ready(f)&e.events;
+        if (ready){
+            p->ready.push_back(&e);
+        }
+        uint32_t mask=0;
+        if (e.events&POLLIN && !ready){
+            mask|=EPOLLIN;
+        }
+        if ((e.events&POLLOUT && !ready) || pending){
+            mask|=EPOLLOUT;
+        }
+        if (io61_poll_register(p,e,mask)<0){
+            return -1;
+        }
+    }
+    int n=0;
+    for (io61_poll_entry* e:p->ready){
+        if (n==maxevents){
+            return n;
+        }
+        evs[n++]={e->f,io61_poll_ready(e->f)&e->events,e->data};
+    }
+    if (n>0){
+        return n;
+    }
+    //Nothing yet; ask the kernel:
+    struct epoll_event kevs[64];
+    int r=epoll_wait(p->epfd,kevs,std::min(maxevents,64),timeout);
+    for (int i=0; i<r; i++){
+        io61_poll_entry* e=(io61_poll_entry*)kevs[i].data.ptr;
+        uint32_t k=kevs[i].events;
+        int ready=0;
+        if (e->f->mode==O_RDONLY){
+            ready=(k&(EPOLLIN|EPOLLHUP|EPOLLERR) ? POLLIN : 0);
+        }
+        else{
+            if (e->f->cur_tag>e->f->start_tag){
+                io61_nb_write(e->f);
+            }
+            ready=(k&(EPOLLHUP|EPOLLERR) ? POLLOUT : io61_poll_ready(e->f));
+        }
+        ready&=e->events;
+        if (ready){
+            evs[n++]={e->f,ready,e->data};
+        }
+    }
+    return r<0 ? -1 : n;
+#else
+    (void) p, (void) evs, (void) maxevents, (void) timeout;
+    errno=ENOSYS;
+    return -1;
+#endif
+}
+
+
+// io61_profile_counters(buf, sz)
+//    Print the counters of every closed io61_file, summed, into `buf` as
+//    JSON members for io61_profile_end. Returns the number of characters
+//    printed (less than `sz`).
+
+int io61_profile_counters(char* buf, size_t sz) {
+    std::lock_guard<std::mutex> guard(io61_totals_mutex);
+    const io61_stats& t=io61_totals;
+    int n=snprintf(buf,sz,", \"syscalls\":%llu, \"bytes_read\":%llu, \"bytes_written\":%llu"
+                   ", \"hits\":%llu, \"misses\":%llu, \"seeks\":%llu, \"flushes\":%llu"
+                   ", \"refills\":%llu",
+                   t.syscalls,t.nread,t.nwritten,t.hits,t.misses,t.seeks,t.flushes,t.refills);
+    return std::max(0,std::min(n,(int)sz-1));
 }
 
 
@@ -247,7 +3480,7 @@ int io61_seek(io61_file* f, off_t pos) {
 //    Open the file corresponding to `filename` and return its io61_file.
 //    If `!filename`, returns either the standard input or the
 //    standard output, depending on `mode`. Exits with an error message if
-//    `filename != nullptr` and the named file cannot be opened.
+//    the file cannot be opened (including O_RDWR on an unseekable file).
 
 io61_file* io61_open_check(const char* filename, int mode) {
     int fd;
@@ -258,11 +3491,13 @@ io61_file* io61_open_check(const char* filename, int mode) {
     } else {
         fd = STDOUT_FILENO;
     }
-    if (fd < 0) {
-        fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+    io61_file* f = fd >= 0 ? io61_fdopen(fd, mode & O_ACCMODE) : nullptr;
+    if (!f) {
+        fprintf(stderr, "%s: %s\n", filename ? filename : "<stdio>",
+                strerror(errno));
         exit(1);
     }
-    return io61_fdopen(fd, mode & O_ACCMODE);
+    return f;
 }
 
 
@@ -271,6 +3506,13 @@ io61_file* io61_open_check(const char* filename, int mode) {
 //    well-defined size (for instance, if it is a pipe).
 
 off_t io61_filesize(io61_file* f) {
+    if (f->cz) {
+        return f->cz->size;
+    }
+    if (f->mode == O_RDWR) {
+        io61_end_run(f);
+        return f->size;
+    }
     struct stat s;
     int r = fstat(f->fd, &s);
     if (r >= 0 && S_ISREG(s.st_mode)) {
@@ -279,3 +3521,4 @@ off_t io61_filesize(io61_file* f) {
         return -1;
     }
 }
+
@@ -4,15 +4,22 @@
 #include <cstdlib>
 #include <cstring>
 #include <cassert>
+#include <cstdint>
 #include <vector>
+#include <algorithm>
+#include <type_traits>
 #include <unistd.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/uio.h>
 
 struct io61_file;
 
 io61_file* io61_fdopen(int fd, int mode);
 io61_file* io61_open_check(const char* filename, int mode);
 int io61_close(io61_file* f);
+int io61_setbuf(io61_file* f, size_t sz);
+int io61_block_cache(size_t budget);
 
 off_t io61_filesize(io61_file* f);
 
@@ -22,17 +29,52 @@ int io61_readc(io61_file* f);
 int io61_writec(io61_file* f, int ch);
 
 ssize_t io61_read(io61_file* f, char* buf, size_t sz);
+int io61_peek(io61_file* f, const char** ptr, size_t* len);
+void io61_consume(io61_file* f, size_t n);
+int io61_readline(io61_file* f, const char** ptr, size_t* len);
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz);
+int io61_reserve(io61_file* f, char** ptr, size_t* len);
+void io61_commit(io61_file* f, size_t n);
+
+ssize_t io61_pread(io61_file* f, char* buf, size_t sz, off_t off);
+ssize_t io61_pwrite(io61_file* f, const char* buf, size_t sz, off_t off);
+int io61_preallocate(io61_file* f, off_t size);
+int io61_sparse(io61_file* f);
+
+ssize_t io61_readv(io61_file* f, const struct iovec* iov, int iovcnt);
+ssize_t io61_writev(io61_file* f, const struct iovec* iov, int iovcnt);
 
 int io61_flush(io61_file* f);
 
+ssize_t io61_copy(io61_file* inf, io61_file* outf, size_t sz);
+
+int io61_async(io61_file* f);
+int io61_compress(io61_file* f);
+int io61_duplex(io61_file* inf, io61_file* outf, long latency);
+int io61_checksum(io61_file* f, uint32_t* digest);
+int io61_nonblock(io61_file* f);
+
+struct io61_poller;
+struct io61_event {
+    io61_file* file;
+    int events;                 // POLLIN and/or POLLOUT
+    void* data;                 // as passed to io61_poller_add
+};
+io61_poller* io61_poller_open();
+int io61_poller_close(io61_poller* p);
+int io61_poller_add(io61_poller* p, io61_file* f, int events, void* data);
+int io61_poller_remove(io61_poller* p, io61_file* f);
+int io61_poller_wait(io61_poller* p, io61_event* evs, int maxevents, int timeout);
+
 void io61_profile_begin();
 void io61_profile_end();
+int io61_profile_counters(char* buf, size_t sz);
 
 
 struct io61_arguments {
     size_t input_size;          // `-s` option: input size. Default SIZE_MAX
     size_t block_size;          // `-b` option: block size. Default 0
+    size_t nthreads;            // `-j` option: number of threads. Default 0
     size_t stride;              // `-t` option: stride. Default 1024
     bool lines;                 // `-l` option: read by lines. Default false
     const char* output_file;    // `-o` option: output file. Default nullptr
@@ -46,4 +88,209 @@ struct io61_arguments {
     void usage();
 };
 
+
+// io61_record_reader<T>, io61_record_writer<T>
+//    Read and write fixed-width binary records of trivially copyable type
+//    `T`. Records are copied straight out of (or into) the cache or the
+//    mapping with io61_peek/io61_consume (io61_reserve/io61_commit); a
+//    record that lies entirely in the current window costs one inline
+//    memcpy and no function call. Records split across a window edge go
+//    through io61_read (io61_write). A reader or writer owns the file's
+//    position until it is destroyed or `sync()`ed; do not mix it with
+//    other calls on the same file before then.
+
+template <typename T>
+class io61_record_reader {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "records must be trivially copyable");
+public:
+    explicit io61_record_reader(io61_file* f)
+        : f_(f) {
+    }
+    io61_record_reader(const io61_record_reader&) = delete;
+    io61_record_reader& operator=(const io61_record_reader&) = delete;
+    ~io61_record_reader() {
+        sync();
+    }
+
+    // read(r)
+    //    Read the next record into `r`. Returns false at end of file, on
+    //    error, or if the file ends with a partial record (see partial()).
+    bool read(T& r) {
+        if (sizeof(T) <= size_t(end_ - pos_)) {
+            memcpy(&r, pos_, sizeof(T));
+            pos_ += sizeof(T);
+            return true;
+        }
+        return read_slow(r);
+    }
+
+    // read(rs, n)
+    //    Read up to `n` records into `rs`. Returns the number read.
+    size_t read(T* rs, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+            size_t k = std::min(n - i, size_t(end_ - pos_) / sizeof(T));
+            if (k == 0) {
+                if (!read_slow(rs[i])) {
+                    break;
+                }
+                ++i;
+                continue;
+            }
+            memcpy(&rs[i], pos_, k * sizeof(T));
+            pos_ += k * sizeof(T);
+            i += k;
+        }
+        return i;
+    }
+
+    // partial(p)
+    //    After read() returns false, point `*p` at the bytes of a partial
+    //    last record (which have been read) and return how many there are.
+    //    The bytes are handed over once: `*p` stays valid until the next
+    //    read(), and a second call returns 0.
+    size_t partial(const char** p) {
+        *p = tail_;
+        size_t n = ntail_;
+        ntail_ = 0;
+        return n;
+    }
+
+    // sync()
+    //    Give the file back its position, just past the last record read.
+    void sync() {
+        if (pos_ != begin_) {
+            io61_consume(f_, pos_ - begin_);
+        }
+        begin_ = end_ = pos_ = nullptr;
+    }
+
+private:
+    io61_file* f_;
+    const char* begin_ = nullptr;   // the window io61_peek returned
+    const char* end_ = nullptr;
+    const char* pos_ = nullptr;     // next unread byte in it
+    char tail_[sizeof(T)];          // a record split across windows
+    size_t ntail_ = 0;
+
+    bool read_slow(T& r) {
+        sync();
+        size_t len;
+        if (io61_peek(f_, &begin_, &len) < 0) {
+            begin_ = nullptr;
+            ntail_ = 0;
+            return false;
+        }
+        end_ = pos_ = begin_;
+        if (len >= sizeof(T)) {
+            end_ = begin_ + len;
+            memcpy(&r, pos_, sizeof(T));
+            pos_ += sizeof(T);
+            return true;
+        }
+        // The record straddles the window edge (or the file has ended):
+        begin_ = end_ = pos_ = nullptr;
+        // (At end of file, keep any partial record not yet handed over.)
+        if (len == 0) {
+            return false;
+        }
+        ssize_t n = io61_read(f_, tail_, sizeof(T));
+        ntail_ = n > 0 && n < ssize_t(sizeof(T)) ? n : 0;
+        if (n == ssize_t(sizeof(T))) {
+            memcpy(&r, tail_, sizeof(T));
+            return true;
+        }
+        return false;
+    }
+};
+
+template <typename T>
+class io61_record_writer {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "records must be trivially copyable");
+public:
+    explicit io61_record_writer(io61_file* f)
+        : f_(f) {
+    }
+    io61_record_writer(const io61_record_writer&) = delete;
+    io61_record_writer& operator=(const io61_record_writer&) = delete;
+    ~io61_record_writer() {
+        sync();
+    }
+
+    // write(r)
+    //    Write record `r`. Returns false on error.
+    bool write(const T& r) {
+        if (sizeof(T) <= size_t(end_ - pos_)) {
+            memcpy(pos_, &r, sizeof(T));
+            pos_ += sizeof(T);
+            return true;
+        }
+        return write_slow(r);
+    }
+
+    // write(rs, n)
+    //    Write the `n` records `rs`. Returns the number written.
+    size_t write(const T* rs, size_t n) {
+        size_t i = 0;
+        while (i < n) {
+            size_t k = std::min(n - i, size_t(end_ - pos_) / sizeof(T));
+            if (k == 0) {
+                if (!write_slow(rs[i])) {
+                    break;
+                }
+                ++i;
+                continue;
+            }
+            memcpy(pos_, &rs[i], k * sizeof(T));
+            pos_ += k * sizeof(T);
+            i += k;
+        }
+        return i;
+    }
+
+    // sync()
+    //    Hand the records written so far to the file (without flushing).
+    void sync() {
+        if (pos_ != begin_) {
+            io61_commit(f_, pos_ - begin_);
+        }
+        begin_ = end_ = pos_ = nullptr;
+    }
+
+    // flush()
+    //    sync(), then io61_flush. Returns 0 on success and -1 on error.
+    int flush() {
+        sync();
+        return io61_flush(f_);
+    }
+
+private:
+    io61_file* f_;
+    char* begin_ = nullptr;     // the window io61_reserve returned
+    char* end_ = nullptr;
+    char* pos_ = nullptr;       // next free byte in it
+
+    bool write_slow(const T& r) {
+        sync();
+        size_t len;
+        if (io61_reserve(f_, &begin_, &len) < 0) {
+            begin_ = nullptr;
+            return false;
+        }
+        end_ = pos_ = begin_;
+        if (len >= sizeof(T)) {
+            end_ = begin_ + len;
+            memcpy(pos_, &r, sizeof(T));
+            pos_ += sizeof(T);
+            return true;
+        }
+        // The record straddles the window edge:
+        begin_ = end_ = pos_ = nullptr;
+        return io61_write(f_, reinterpret_cast<const char*>(&r), sizeof(T))
+            == ssize_t(sizeof(T));
+    }
+};
+
 #endif
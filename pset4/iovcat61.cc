@@ -0,0 +1,59 @@
+#include "io61.hh"
+
+// Usage: ./iovcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE with io61_readv and io61_writev.
+//    Each round moves one byte with io61_readc and io61_writec, then
+//    scatters the next bytes over four buffers (BLOCKSIZE bytes, an empty
+//    buffer, 1 byte, and 7 bytes plus 0, 1 or 2 times BLOCKSIZE) and
+//    gathers the same buffers back out, so large rounds bypass the caches
+//    and small ones go through them. Default BLOCKSIZE is 5000.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 5000;
+
+    // Allocate buffers, open files
+    char* buf = new char[block_size];
+    char byte[1];
+    char* tail = new char[2 * block_size + 7];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Copy file data
+    for (size_t round = 0; ; ++round) {
+        int ch = io61_readc(inf);
+        if (ch == EOF) {
+            break;
+        }
+        io61_writec(outf, ch);
+
+        struct iovec iov[4] = {
+            {buf, block_size}, {byte, 0}, {byte, 1},
+            {tail, (round % 3) * block_size + 7}
+        };
+        ssize_t amount = io61_readv(inf, iov, 4);
+        if (amount <= 0) {
+            break;
+        }
+        // Trim the buffers to the bytes read
+        size_t left = amount;
+        for (auto& v : iov) {
+            v.iov_len = std::min(v.iov_len, left);
+            left -= v.iov_len;
+        }
+        if (io61_writev(outf, iov, 4) != amount) {
+            perror("io61_writev");
+            exit(1);
+        }
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+    delete[] tail;
+}
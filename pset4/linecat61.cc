@@ -0,0 +1,47 @@
+#include "io61.hh"
+
+// Usage: ./linecat61 [-b BUFSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE a line at a time with io61_readline.
+//    With -b, FILE is read through a cache of BUFSIZE bytes set with
+//    io61_setbuf, so more lines span refills. Fails if a line has a
+//    newline anywhere but at its end, or if a line other than the last
+//    lacks one.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+
+    // Open files
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    if (args.block_size && io61_setbuf(inf, args.block_size) < 0) {
+        fprintf(stderr, "io61_setbuf failed\n");
+        exit(1);
+    }
+
+    // Copy lines
+    bool ended = false;
+    while (1) {
+        const char* line;
+        size_t len;
+        if (io61_readline(inf, &line, &len) < 0) {
+            perror("io61_readline");
+            exit(1);
+        } else if (len == 0) {
+            break;
+        }
+        const char* nl = (const char*) memchr(line, '\n', len);
+        if (ended || (nl && nl != line + len - 1)) {
+            fprintf(stderr, "bad line of length %zu\n", len);
+            exit(1);
+        }
+        ended = !nl;
+        io61_write(outf, line, len);
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+}
@@ -0,0 +1,150 @@
+#include "io61.hh"
+#include <cerrno>
+#include <vector>
+
+// Usage: ./pollcat61 [-j NPIPES] [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE through NPIPES pipes with a single
+//    thread. Block i of FILE is written to pipe i % NPIPES, and OUTFILE
+//    is put back together by reading the blocks from the pipes in order.
+//    Every pipe end is a nonblocking io61_file, and an io61_poller waits
+//    for whichever end the copy is stuck on, so the thread never blocks on
+//    a full or empty pipe. Default NPIPES is 16 and default BLOCKSIZE is
+//    100000 (more than a pipe holds).
+
+struct pipe_ends {
+    io61_file* w;
+    io61_file* r;
+};
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "j:b:o:");
+    size_t block_size = args.block_size ? args.block_size : 100000;
+    size_t npipes = args.nthreads ? args.nthreads : 16;
+
+    // Allocate buffers, open files and pipes
+    char* inbuf = new char[block_size];
+    char* outbuf = new char[block_size];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    io61_poller* poller = io61_poller_open();
+    if (!poller) {
+        perror("io61_poller_open");
+        exit(1);
+    }
+    std::vector<pipe_ends> pipes(npipes);
+    for (auto& p : pipes) {
+        int fds[2];
+        if (pipe(fds) < 0) {
+            perror("pipe");
+            exit(1);
+        }
+        p.r = io61_fdopen(fds[0], O_RDONLY);
+        p.w = io61_fdopen(fds[1], O_WRONLY);
+        if (io61_nonblock(p.r) < 0 || io61_nonblock(p.w) < 0) {
+            perror("io61_nonblock");
+            exit(1);
+        }
+        io61_poller_add(poller, p.r, 0, nullptr);
+        io61_poller_add(poller, p.w, 0, nullptr);
+    }
+
+    // Copy file data
+    size_t inblock = 0, inlen = 0, inoff = 0;
+    size_t outblock = 0, outlen = 0;
+    bool ineof = false;
+    io61_file* waitr = nullptr;
+    io61_file* waitw = nullptr;
+    while (true) {
+        // Feed blocks to the pipes until one is full
+        while (!ineof) {
+            if (inoff == inlen) {
+                ssize_t amount = io61_read(inf, inbuf, block_size);
+                if (amount <= 0) {
+                    ineof = true;
+                    break;
+                }
+                inlen = amount;
+                inoff = 0;
+            }
+            ssize_t amount = io61_write(pipes[inblock % npipes].w,
+                                        inbuf + inoff, inlen - inoff);
+            if (amount < 0) {
+                assert(errno == EAGAIN);
+                break;
+            }
+            inoff += amount;
+            if (inoff == inlen) {
+                ++inblock;
+            }
+        }
+
+        // After the last block, close each write end once it drains
+        for (auto& p : pipes) {
+            if (ineof && p.w && io61_flush(p.w) == 0) {
+                if (p.w == waitw) {
+                    waitw = nullptr;
+                }
+                io61_poller_remove(poller, p.w);
+                io61_close(p.w);
+                p.w = nullptr;
+            }
+        }
+
+        // Read blocks back in order until one has not arrived yet
+        ssize_t amount;
+        while ((amount = io61_read(pipes[outblock % npipes].r, outbuf,
+                                   block_size - outlen)) > 0) {
+            io61_write(outf, outbuf, amount);
+            outlen += amount;
+            if (outlen == block_size) {
+                ++outblock;
+                outlen = 0;
+            }
+        }
+        if (amount == 0) {
+            // This block's pipe ended, so the input did too
+            break;
+        }
+        assert(errno == EAGAIN);
+
+        // Wait for the pipe ends we are stuck on (the poller writes out
+        // the other write ends' buffers meanwhile)
+        if (waitr) {
+            io61_poller_add(poller, waitr, 0, nullptr);
+        }
+        if (waitw) {
+            io61_poller_add(poller, waitw, 0, nullptr);
+        }
+        waitr = pipes[outblock % npipes].r;
+        waitw = ineof ? nullptr : pipes[inblock % npipes].w;
+        io61_poller_add(poller, waitr, POLLIN, nullptr);
+        if (waitw) {
+            io61_poller_add(poller, waitw, POLLOUT, nullptr);
+        }
+        io61_event evs[2];
+        if (io61_poller_wait(poller, evs, 2, -1) < 0) {
+            perror("io61_poller_wait");
+            exit(1);
+        }
+    }
+
+    for (auto& p : pipes) {
+        io61_poller_remove(poller, p.r);
+        io61_close(p.r);
+        if (p.w) {
+            io61_poller_remove(poller, p.w);
+            io61_close(p.w);
+        }
+    }
+    io61_poller_close(poller);
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] inbuf;
+    delete[] outbuf;
+}
@@ -11,6 +11,14 @@
 
 static struct timeval tv_begin;
 
+// io61_profile_counters(buf, sz)
+//    An io61 implementation that keeps counters replaces this with a
+//    version that prints them as more JSON members of the report.
+
+__attribute__((weak)) int io61_profile_counters(char*, size_t) {
+    return 0;
+}
+
 void io61_profile_begin() {
     int r = gettimeofday(&tv_begin, 0);
     assert(r >= 0);
@@ -32,11 +40,13 @@ void io61_profile_end() {
     timeradd(&usage.ru_stime, &cusage.ru_stime, &usage.ru_stime);
 
     char buf[1000];
-    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld}\n",
+    int len = sprintf(buf, "{\"time\":%ld.%06ld, \"utime\":%ld.%06ld, \"stime\":%ld.%06ld, \"maxrss\":%ld",
                       tv_end.tv_sec, (long) tv_end.tv_usec,
                       usage.ru_utime.tv_sec, (long) usage.ru_utime.tv_usec,
                       usage.ru_stime.tv_sec, (long) usage.ru_stime.tv_usec,
                       usage.ru_maxrss + cusage.ru_maxrss);
+    len += io61_profile_counters(buf + len, sizeof(buf) - len - 2);
+    len += sprintf(buf + len, "}\n");
 
     // Print the report to file descriptor 100 if it's available. Our
     // `check.pl` test harness uses this file descriptor.
@@ -53,6 +63,7 @@ void io61_profile_end() {
 io61_arguments::io61_arguments(int argc, char** argv, const char* opts_) {
     input_size = -1;
     block_size = 0;
+    nthreads = 0;
     stride = 1024;
     lines = false;
     output_file = input_file = nullptr;
@@ -75,6 +86,12 @@ io61_arguments::io61_arguments(int argc, char** argv, const char* opts_) {
                 goto usage;
             }
             break;
+        case 'j':
+            nthreads = (size_t) strtoul(optarg, &endptr, 0);
+            if (nthreads == 0 || endptr == optarg || *endptr) {
+                goto usage;
+            }
+            break;
         case 't':
             stride = (size_t) strtoul(optarg, &endptr, 0);
             if (stride == 0 || endptr == optarg || *endptr) {
@@ -130,6 +147,9 @@ io61_arguments::io61_arguments(int argc, char** argv, const char* opts_) {
 
 void io61_arguments::usage() {
     fprintf(stderr, "Usage: %s", program_name);
+    if (strchr(opts, 'j')) {
+        fprintf(stderr, " [-j NTHREADS]");
+    }
     if (strchr(opts, 's')) {
         fprintf(stderr, " [-s SIZE]");
     }
@@ -0,0 +1,55 @@
+#include "io61.hh"
+#include <cstdint>
+
+// Usage: ./recordcat61 [-b NRECORDS] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE as 16-byte binary records, with
+//    io61_record_reader and io61_record_writer. With -b, records are
+//    copied NRECORDS at a time; otherwise one at a time. A partial record
+//    at the end of FILE is copied too.
+
+struct record {
+    uint64_t key;
+    uint64_t value;
+};
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t nrecords = args.block_size;
+
+    // Allocate buffer, open files
+    record* buf = new record[nrecords ? nrecords : 1];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+
+    // Copy records
+    io61_record_reader<record> reader(inf);
+    io61_record_writer<record> writer(outf);
+    if (nrecords) {
+        size_t n;
+        while ((n = reader.read(buf, nrecords)) > 0) {
+            writer.write(buf, n);
+        }
+    } else {
+        record r;
+        while (reader.read(r)) {
+            writer.write(r);
+        }
+    }
+    reader.sync();
+    writer.sync();
+
+    // Copy any partial record
+    const char* tail;
+    if (size_t n = reader.partial(&tail)) {
+        io61_write(outf, tail, n);
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+}
@@ -0,0 +1,77 @@
+#include "io61.hh"
+#include <cerrno>
+
+// Usage: ./rwcat61 [-b BLOCKSIZE] -o OUTFILE [FILE]
+//    Copies the input FILE into OUTFILE, which is opened read-write, and
+//    then edits OUTFILE in place through the same io61_file, with no
+//    flushes: two passes each read every block, seek back, and write it
+//    reversed over itself. The second pass restores the copy only if
+//    every read sees the writes before it. First checks that a pipe
+//    cannot be opened read-write (io61_fdopen fails with ESPIPE).
+//    Default BLOCKSIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+    if (!args.output_file) {
+        args.usage();
+        exit(1);
+    }
+
+    // Unseekable files cannot be read-write
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    errno = 0;
+    if (io61_fdopen(fds[0], O_RDWR) || errno != ESPIPE) {
+        fprintf(stderr, "io61_fdopen(pipe, O_RDWR) did not fail with ESPIPE\n");
+        exit(1);
+    }
+    close(fds[0]);
+    close(fds[1]);
+
+    // Allocate buffer, open files
+    char* buf = new char[block_size];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* f = io61_open_check(args.output_file,
+                                   O_RDWR | O_CREAT | O_TRUNC);
+
+    // Copy file data
+    while (1) {
+        ssize_t amount = io61_read(inf, buf, block_size);
+        if (amount <= 0) {
+            break;
+        }
+        io61_write(f, buf, amount);
+    }
+
+    // Reverse each block in place, twice
+    for (int pass = 0; pass < 2; ++pass) {
+        if (io61_seek(f, 0) < 0) {
+            perror("io61_seek");
+            exit(1);
+        }
+        for (off_t pos = 0; ; pos += block_size) {
+            ssize_t amount = io61_read(f, buf, block_size);
+            if (amount <= 0) {
+                break;
+            }
+            std::reverse(buf, buf + amount);
+            io61_seek(f, pos);
+            io61_write(f, buf, amount);
+        }
+    }
+
+    io61_close(inf);
+    if (io61_close(f) < 0) {
+        perror("io61_close");
+        exit(1);
+    }
+    io61_profile_end();
+    delete[] buf;
+}
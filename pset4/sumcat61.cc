@@ -0,0 +1,95 @@
+#include "io61.hh"
+
+// Usage: ./sumcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Copies the input FILE to OUTFILE in blocks with checksums on both
+//    files, and fails if their digests differ. Then checks io61_checksum
+//    against the CRC32C test vectors of RFC 3720, each written a byte at
+//    a time into a pipe and read back in a block. Default BLOCKSIZE is
+//    4096.
+
+struct crc_vector {
+    unsigned char data[32];
+    size_t len;
+    uint32_t crc;
+};
+
+static void check_vector(const crc_vector& v) {
+    int fds[2];
+    if (pipe(fds) < 0) {
+        perror("pipe");
+        exit(1);
+    }
+    io61_file* w = io61_fdopen(fds[1], O_WRONLY);
+    io61_file* r = io61_fdopen(fds[0], O_RDONLY);
+    uint32_t wcrc = 0, rcrc = 0;
+    io61_checksum(w, &wcrc);
+    io61_checksum(r, &rcrc);
+    for (size_t i = 0; i != v.len; ++i) {
+        io61_writec(w, v.data[i]);
+    }
+    io61_close(w);
+    char buf[64];
+    if (io61_read(r, buf, sizeof(buf)) != (ssize_t) v.len) {
+        fprintf(stderr, "short read\n");
+        exit(1);
+    }
+    io61_close(r);
+    if (wcrc != v.crc || rcrc != v.crc) {
+        fprintf(stderr, "CRC32C of %zu-byte vector: wrote %08x, read %08x, "
+                "expected %08x\n", v.len, wcrc, rcrc, v.crc);
+        exit(1);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = new char[block_size];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    uint32_t incrc = 0, outcrc = 1;
+    io61_checksum(inf, &incrc);
+    io61_checksum(outf, &outcrc);
+
+    // Copy file data
+    while (1) {
+        ssize_t amount = io61_read(inf, buf, block_size);
+        if (amount <= 0) {
+            break;
+        }
+        io61_write(outf, buf, amount);
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+    if (incrc != outcrc) {
+        fprintf(stderr, "CRC32C differs: read %08x, wrote %08x\n",
+                incrc, outcrc);
+        exit(1);
+    }
+
+    // Check the test vectors
+    crc_vector vectors[5] = {
+        {{0}, 32, 0x8A9136AA},
+        {{0}, 32, 0x62A8AB43},
+        {{0}, 32, 0x46DD794E},
+        {{0}, 32, 0x113FDB5C},
+        {{'1', '2', '3', '4', '5', '6', '7', '8', '9'}, 9, 0xE3069283}
+    };
+    for (int i = 0; i != 32; ++i) {
+        vectors[1].data[i] = 0xFF;
+        vectors[2].data[i] = i;
+        vectors[3].data[i] = 31 - i;
+    }
+    for (auto& v : vectors) {
+        check_vector(v);
+    }
+}
@@ -0,0 +1,60 @@
+#include "io61.hh"
+
+// Usage: ./unzcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Decompresses the input FILE, as written by zcat61, into OUTFILE.
+//    If FILE has a block index (it is seekable) and OUTFILE is given,
+//    the blocks are read last to first with io61_seek, and each is
+//    written at its place in OUTFILE; otherwise they are copied in order.
+//    Default BLOCKSIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = new char[block_size];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    if (io61_compress(inf) < 0) {
+        fprintf(stderr, "io61_compress failed\n");
+        exit(1);
+    }
+
+    // Copy file data
+    off_t size = io61_filesize(inf);
+    if (size >= 0 && args.output_file) {
+        for (off_t pos = (size - 1) / block_size * block_size;
+             size > 0 && pos >= 0; pos -= block_size) {
+            if (io61_seek(inf, pos) < 0 || io61_seek(outf, pos) < 0) {
+                perror("io61_seek");
+                exit(1);
+            }
+            ssize_t amount = io61_read(inf, buf, block_size);
+            if (amount <= 0) {
+                fprintf(stderr, "short read at %lld\n", (long long) pos);
+                exit(1);
+            }
+            io61_write(outf, buf, amount);
+        }
+    } else {
+        while (1) {
+            ssize_t amount = io61_read(inf, buf, block_size);
+            if (amount < 0) {
+                perror("io61_read");
+                exit(1);
+            } else if (amount == 0) {
+                break;
+            }
+            io61_write(outf, buf, amount);
+        }
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    delete[] buf;
+}
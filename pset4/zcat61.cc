@@ -0,0 +1,41 @@
+#include "io61.hh"
+
+// Usage: ./zcat61 [-b BLOCKSIZE] [-o OUTFILE] [FILE]
+//    Compresses the input FILE into OUTFILE, which is put in compressed
+//    mode with io61_compress, copying in blocks. unzcat61 reverses this.
+//    Default BLOCKSIZE is 4096.
+
+int main(int argc, char* argv[]) {
+    // Parse arguments
+    io61_arguments args(argc, argv, "b:o:i:");
+    size_t block_size = args.block_size ? args.block_size : 4096;
+
+    // Allocate buffer, open files
+    char* buf = new char[block_size];
+
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(args.input_file, O_RDONLY);
+    io61_file* outf = io61_open_check(args.output_file,
+                                      O_WRONLY | O_CREAT | O_TRUNC);
+    if (io61_compress(outf) < 0) {
+        fprintf(stderr, "io61_compress failed\n");
+        exit(1);
+    }
+
+    // Copy file data
+    while (1) {
+        ssize_t amount = io61_read(inf, buf, block_size);
+        if (amount <= 0) {
+            break;
+        }
+        io61_write(outf, buf, amount);
+    }
+
+    io61_close(inf);
+    if (io61_close(outf) < 0) {
+        perror("io61_close");
+        exit(1);
+    }
+    io61_profile_end();
+    delete[] buf;
+}